@@ -8,21 +8,376 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <math.h> 
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Defining constants
 #define Total_Alphabets 26
 #define MAX_WORD_LENGTH 100
 #define MAX_SUGGESTIONS 3
 #define LEVENSHTEIN_LIMIT 2
+// Most corrections listed for a word, the best by score
+#define MAX_CORRECTION_CANDIDATES 1000
+// Limits on the threads used to build the corpus trie, each of which gets at least MIN_INGEST_CHUNK bytes
+#define MAX_INGEST_THREADS 64
+#define MIN_INGEST_CHUNK (1 << 20)
+
+// Nodes are allocated from fixed-size slabs, so a node never moves once it is created
+#define NODE_SLAB_SHIFT 12
+#define NODE_SLAB_SIZE (1u << NODE_SLAB_SHIFT)
+#define NODE_SLAB_MASK (NODE_SLAB_SIZE - 1)
+// Index 0 of every pool is reserved, so a child index of 0 means "no child"
+#define NULL_NODE 0
+
+// Time in seconds for the weight of a word typed by the user to halve when it is not typed again
+#ifndef RECENCY_HALF_LIFE
+#define RECENCY_HALF_LIFE (30.0 * 24 * 3600)
+#endif
+
+// Nodes refer to each other with 32-bit indices into their trie's pool instead of pointers
+typedef uint32_t NodeId;
+
+// Structure of a count decaying exponentially with time: value is the decayed count as it was at
+// time, in seconds. It is only brought up to date when it is written, and two of them are compared
+// by decaying the older one to the time of the other, so their order never changes as time passes.
+typedef struct Recency {
+    float value;
+    uint32_t time;
+} Recency;
+
+// Kinds of the blocks holding the children of a node of a trie which is not frozen. A node starts
+// without a block and moves to a block of the next kind once its block is full, so a node only takes
+// the room its children need, while a child can have any byte as its label.
+enum {
+    CHILDREN_NONE,
+    CHILDREN_4,
+    CHILDREN_16,
+    CHILDREN_48,
+    CHILDREN_256,
+    CHILD_KINDS
+};
+
+// Blocks of up to 4 and 16 children, whose labels are kept sorted
+typedef struct ChildBlock4 {
+    uint8_t labels[4];
+    NodeId children[4];
+} ChildBlock4;
+
+typedef struct ChildBlock16 {
+    uint8_t labels[16];
+    NodeId children[16];
+} ChildBlock16;
+
+// Block of up to 48 children, found through the position of the child of each label plus one, 0 for none
+typedef struct ChildBlock48 {
+    uint8_t positions[256];
+    NodeId children[48];
+} ChildBlock48;
+
+// Block with the child of every label
+typedef struct ChildBlock256 {
+    NodeId children[256];
+} ChildBlock256;
+
+// Structure of the pool the blocks of one kind are allocated from. Blocks are referred to by their
+// index, and the blocks a node leaves when it grows are reused through a list of free blocks.
+typedef struct ChildPool {
+    char *blocks;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t freeList;
+} ChildPool;
+
+// Structure of the reference of a node to its children: the block holding them, in the pool of its
+// kind, and their number. Its fields fit in one word, which is written at once when the children change,
+// so a reader of a concurrent trie never sees the block of one version with the count of another.
+typedef union ChildLink {
+    struct {
+        uint32_t block;
+        uint16_t count;
+        uint8_t kind;
+    };
+    uint64_t word;
+} ChildLink;
 
 // Structure of TrieNode
 typedef struct TrieNode {
-    struct TrieNode *children[Total_Alphabets];
-    // A weight component which represent the frequency of the word
-    double weight;
+    ChildLink childLink;
+    // A weight component which represent the frequency of the word, kept as the raw count
+    uint32_t weight;
+    // The highest weight of any word ending at this node or below it
+    uint32_t subtreeMax;
+    // The decayed count of the word as typed by the user, and the highest one below the node. They
+    // are kept for the words of the main trie, and for the user words of a unified trie. They are
+    // aligned to be read and written in one access.
+    Recency recency __attribute__((aligned(8)));
+    Recency subtreeRecency __attribute__((aligned(8)));
     bool checkisEndOfWord;
+    bool checkisUserWord;
+    // Set while the node is in the list of nodes holding user weights
+    bool userTouched;
 } TrieNode;
 
+// In a frozen trie, the child count of a node holds its number of children and this flag
+#define FROZEN_END_OF_WORD (1u << 31)
+#define FROZEN_CHILD_COUNT 0x1FFu
+
+// In a radix trie, a position on the edge leading to a node is the index of the node in the low bits
+// of a NodeId and the number of letters of the edge left before the node in the high bits, so a node
+// is its own position. Edges are shorter than MAX_WORD_LENGTH, which fits in the 7 high bits.
+#define RADIX_NODE_BITS 25
+#define RADIX_NODE_MASK ((1u << RADIX_NODE_BITS) - 1)
+
+// Identification of the binary snapshot files holding a frozen corpus trie
+#define SNAPSHOT_MAGIC "CS201TRI"
+#define SNAPSHOT_VERSION 8
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+// Set in the flags of a snapshot whose arrays are followed by the recency and subtreeRecency arrays
+#define SNAPSHOT_HAS_RECENCY 1u
+// Set in the flags of a snapshot of a radix trie, whose labels are followed by the edges of the nodes
+#define SNAPSHOT_RADIX 2u
+
+// Header at the start of a snapshot file, followed by the childCount, firstChild, weights and subtreeMax
+// arrays, the recency arrays when they are kept, and the labels of the nodes padded to 8 bytes. The
+// labels of a radix trie are followed by its edgeStart and edgeLength arrays and the letters of its
+// edges, each padded to 8 bytes too.
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    // Written as SNAPSHOT_BYTE_ORDER so files from a machine with another byte order are rejected
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    NodeId root;
+    uint32_t maxWeight;
+    // For a snapshot of the learning memory, the generation of the last log whose words it holds
+    uint32_t logGeneration;
+    uint32_t flags;
+    // Sizes of the frozen n-gram model stored after the arrays of the nodes: its fingerprints, then its
+    // next words, its quantized counts and the letters of its next words
+    uint32_t ngramSlots;
+    uint32_t followerSlots;
+    uint32_t ngramWordBytes;
+    // Number of letters of the edges of a radix trie
+    uint32_t edgeBytes;
+    // Keeps the size of the header a multiple of 8, so the arrays of 64-bit n-gram keys stay aligned
+    uint32_t reserved;
+} SnapshotHeader;
+
+// Number of best next words kept for every word of a frozen n-gram model
+#define NGRAM_FOLLOWERS MAX_SUGGESTIONS
+// Slots of the table of the next words whose letters are looked for, a power of two at least twice
+// NGRAM_FOLLOWERS so its probing reaches every slot
+#define NGRAM_WANTED_SLOTS 8
+// Share of the trigram estimate in the probability of a word after two known words
+#define NGRAM_TRIGRAM_SHARE 0.7
+// Completions ranked by weight for every suggestion shown, before the words of the sentence re-rank them
+#define NGRAM_RERANK_FACTOR 4
+
+// Structure of the best next words of a word in a frozen n-gram model, as offsets of their letters
+typedef struct NgramFollowers {
+    uint64_t word;
+    uint32_t next[NGRAM_FOLLOWERS];
+} NgramFollowers;
+
+// Structure of a bigram of a model being built, with the hashes of its two words and its count. The
+// fields of a slot are kept together so a lookup touches one cache line.
+typedef struct NgramBigram {
+    uint64_t first;
+    uint64_t second;
+    uint32_t count;
+} NgramBigram;
+
+// Structure of a trigram of a model being built, with its fingerprint and its count
+typedef struct NgramTrigram {
+    uint64_t key;
+    uint32_t count;
+} NgramTrigram;
+
+// Structure of the bigram and trigram counts of a text, used to rank words by the words before them.
+// Words are identified by the hash of their letters, so the counts do not depend on the nodes of any
+// trie. While the model is built, every bigram keeps the hashes of both of its words; freezing keeps
+// only a fingerprint of every n-gram with its count quantized to a byte, and the letters of the best
+// next words of every word.
+typedef struct NgramModel {
+    bool frozen;
+    // Open-addressing tables of the bigrams and of the trigrams of a model being built. A first word
+    // of 0 marks an empty bigram slot, and a key of 0 an empty trigram slot.
+    uint32_t bigramSlots;
+    uint32_t bigramCount;
+    NgramBigram *bigrams;
+    uint32_t trigramSlots;
+    uint32_t trigramCount;
+    NgramTrigram *trigrams;
+    // Open-addressing table of the fingerprints of every n-gram of a frozen model, with their counts
+    uint32_t slotCount;
+    uint64_t *keys;
+    uint8_t *levels;
+    // Best next words of every word of a frozen model, whose letters are stored in words
+    uint32_t followerSlots;
+    NgramFollowers *followers;
+    char *words;
+    uint32_t wordBytes;
+    // The last two words added, which the next word follows, and the first two words of the text
+    uint64_t previous[2];
+    int previousCount;
+    uint64_t first[2];
+    int firstCount;
+    // Odd while the bigram or trigram table is being replaced by a bigger one, so readers of a
+    // concurrent trie read a table with its own number of slots. The replaced tables are retired to
+    // the list of the trie, or freed at once when it is NULL.
+    uint32_t tableSequence;
+    struct RetireList *retired;
+} NgramModel;
+
+// Structure of the memory a concurrent trie stopped using while readers could still be going through
+// it: an array to free, or a block of children to give back to its pool. It is kept until every reader
+// which was reading when it was retired has finished.
+typedef struct RetiredMemory {
+    void *memory;
+    struct Trie *trie;
+    uint32_t block;
+    uint8_t kind;
+    uint64_t epoch;
+} RetiredMemory;
+
+typedef struct RetireList {
+    RetiredMemory *items;
+    uint32_t count;
+    uint32_t capacity;
+} RetireList;
+
+// Structure of a Trie, which owns the pool all of its nodes are allocated from
+typedef struct Trie {
+    TrieNode **slabs;
+    uint32_t slabCount;
+    uint32_t slabCapacity;
+    // Number of node slots handed out so far, including the reserved slot 0
+    uint32_t nodeCount;
+    NodeId root;
+    ChildPool childPools[CHILD_KINDS];
+    // Incremented on every change of the words or weights, so cached results can tell they are stale
+    uint32_t version;
+    // The highest weight of any word, kept up to date on insertion. Weights are stored as raw counts
+    // and only divided by it when they are read, so learning a word never rewrites the other nodes.
+    uint32_t maxWeight;
+    // Set once a word was learned with the time it was typed, the weights of the words are then their
+    // decayed counts, divided by the highest one when they are read
+    bool hasRecency;
+    // Read-only layout built by freeze_trie, used in place of the slabs once frozen is set.
+    // Nodes are numbered breadth-first, so the children of a node are stored next to each
+    // other in label order and a child is found by searching their labels.
+    bool frozen;
+    uint32_t *childCount;
+    NodeId *firstChild;
+    uint8_t *labels;
+    uint32_t *weights;
+    uint32_t *subtreeMax;
+    Recency *recency;
+    Recency *subtreeRecency;
+    // Set for a frozen trie whose chains of nodes with a single child and no word are merged into the
+    // edge leading to the next node. The letters of the edge of a node are edgeLength[node] letters of
+    // edges starting at edgeStart[node], and the label of the node is the first of them.
+    bool radix;
+    uint32_t *edgeStart;
+    uint8_t *edgeLength;
+    uint8_t *edges;
+    uint32_t edgeBytes;
+    // Set when the frozen arrays point into a mapped snapshot file instead of owned memory
+    void *mapping;
+    size_t mappingSize;
+    // Set for a unified trie, whose nodes hold the weights of both the corpus and the user words.
+    // The nodes whose user fields are set are listed so they can be cleared without a full walk.
+    bool unified;
+    NodeId *userTouched;
+    uint32_t userTouchedCount;
+    uint32_t userTouchedCapacity;
+    // Bigrams and trigrams of the words of the trie, in the order they were inserted. A unified trie
+    // learns the ones of the user in its own model and reads the ones of the corpus from corpusNgrams.
+    NgramModel ngrams;
+    const NgramModel *corpusNgrams;
+    // Set by make_trie_concurrent for a trie which threads query while one thread learns words into
+    // it. Its writer then never changes in place what a reader could be going through: it writes a
+    // copy, publishes it and retires the old one.
+    bool concurrent;
+    RetireList retired;
+    // Cache of the best completions of the prefixes queried most, set by enable_prefix_cache for a main
+    // trie. Learning a word forgets the cached results of its prefixes.
+    struct PrefixCache *prefixCache;
+} Trie;
+
+// Counters of the work done by the hot paths, compiled in only with -DAUTOFILL_STATS. Each thread
+// counts in its own copy, which is added to the totals when the thread ends.
+#ifdef AUTOFILL_STATS
+typedef struct Stats {
+    // Search entries expanded by suggestWords and trie nodes reached by collect_suggestions
+    unsigned long long fillNodesVisited;
+    unsigned long long correctNodesVisited;
+    // Distances computed between two words, and the table cells computed by every distance
+    unsigned long long levenshteinCalls;
+    unsigned long long levenshteinCells;
+    unsigned long long createNodeCalls;
+    // Nodes allocated minus nodes released, over every trie
+    long long liveNodes;
+    unsigned long long queries;
+    double ingestSeconds;
+    double freezeSeconds;
+    double querySeconds;
+} Stats;
+
+static _Thread_local Stats threadStats;
+static Stats totalStats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function to get the time in seconds from a monotonic clock
+static double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to add the counters of the calling thread to the totals
+static void stats_flush_thread(void) {
+    pthread_mutex_lock(&statsLock);
+    totalStats.fillNodesVisited += threadStats.fillNodesVisited;
+    totalStats.correctNodesVisited += threadStats.correctNodesVisited;
+    totalStats.levenshteinCalls += threadStats.levenshteinCalls;
+    totalStats.levenshteinCells += threadStats.levenshteinCells;
+    totalStats.createNodeCalls += threadStats.createNodeCalls;
+    totalStats.liveNodes += threadStats.liveNodes;
+    totalStats.queries += threadStats.queries;
+    totalStats.ingestSeconds += threadStats.ingestSeconds;
+    totalStats.freezeSeconds += threadStats.freezeSeconds;
+    totalStats.querySeconds += threadStats.querySeconds;
+    pthread_mutex_unlock(&statsLock);
+    memset(&threadStats, 0, sizeof(threadStats));
+}
+
+#define STAT_ADD(field, amount) (threadStats.field += (amount))
+#define STAT_TIMER(name) double name = stats_now()
+#define STAT_ADD_TIME(field, timer) (threadStats.field += stats_now() - (timer))
+#define STAT_FLUSH_THREAD() stats_flush_thread()
+#else
+#define STAT_ADD(field, amount) ((void)0)
+#define STAT_TIMER(name) ((void)0)
+#define STAT_ADD_TIME(field, timer) ((void)0)
+#define STAT_FLUSH_THREAD() ((void)0)
+#endif
+
+// Set by --trace to print the work done by every query after its answer
+bool traceQueries = false;
+
 // Structure for holding suggestions
 typedef struct Suggestion {
     char word[MAX_WORD_LENGTH];
@@ -31,387 +386,5417 @@ typedef struct Suggestion {
     bool combined; 
 } Suggestion;
 
+// Identification of the binary files holding a SymSpell correction index
+#define SYMSPELL_MAGIC "CS201SYM"
+#define SYMSPELL_VERSION 1
 
-// Creation of a new TrieNode
-TrieNode *create_node() {
-    TrieNode *new_node = (TrieNode *)malloc(sizeof(TrieNode));
-    if (new_node == NULL) {
-        printf("Memory allocation failed!\n");
-        exit(1);
+// Structure of a slot of the SymSpell hash table. It maps the hash of a deletion variant to the
+// run of postings holding the ids of the words which produce it. A hash of 0 marks an empty slot.
+typedef struct SymSpellSlot {
+    uint64_t hash;
+    uint32_t start;
+    uint32_t count;
+} SymSpellSlot;
+
+// Structure of the symmetric-delete correction index built from the words of the corpus trie.
+// Every word is stored with each variant obtained by deleting up to LEVENSHTEIN_LIMIT letters,
+// so the corrections of an input are found by looking up the deletion variants of the input.
+typedef struct SymSpellIndex {
+    uint32_t wordCount;
+    // Number of slots of the open-addressing table, always a power of two
+    uint32_t slotCount;
+    uint32_t postingCount;
+    uint32_t stringBytes;
+    // Start of each word in strings, and its weight in the corpus trie
+    uint32_t *wordOffsets;
+    float *wordWeights;
+    SymSpellSlot *slots;
+    uint32_t *postings;
+    char *strings;
+    // Set when the arrays point into a mapped index file instead of owned memory
+    void *mapping;
+    size_t mappingSize;
+} SymSpellIndex;
+
+// Header at the start of a SymSpell index file, followed by the arrays in the order of the structure
+typedef struct SymSpellHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t wordCount;
+    uint32_t slotCount;
+    uint32_t postingCount;
+    uint32_t stringBytes;
+} SymSpellHeader;
+
+
+// Loads and stores of the fields readers of a concurrent trie read while its writer changes them. They
+// are plain moves on the usual targets, but the compiler never splits, merges or drops them.
+#define SHARED_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define SHARED_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static inline Recency load_recency(const Recency *recency) {
+    Recency value;
+    __atomic_load(recency, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+static inline void store_recency(Recency *recency, Recency value) {
+    __atomic_store(recency, &value, __ATOMIC_RELAXED);
+}
+
+// Getting the address of a node from its index in the pool
+static inline TrieNode *get_node(const Trie *trie, NodeId id) {
+    TrieNode **slabs = __atomic_load_n(&trie->slabs, __ATOMIC_ACQUIRE);
+    return &slabs[id >> NODE_SLAB_SHIFT][id & NODE_SLAB_MASK];
+}
+
+// Checking whether a byte can be part of a word: an ASCII letter, or any byte of a UTF-8 encoded
+// character, which all have their high bit set
+static inline bool is_word_byte(unsigned char c) {
+    return (unsigned char)((c | 0x20) - 'a') < Total_Alphabets || c >= 0x80;
+}
+
+// Lowercasing a byte of a word. Only ASCII letters are lowercased, the bytes of other characters are kept.
+static inline unsigned char lower_word_byte(unsigned char c) {
+    return c < 0x80 ? c | 0x20 : c;
+}
+
+// Getting the number of bytes of the UTF-8 character starting with a byte when it separates words like
+// ASCII punctuation, or 0. Such characters are found by their first byte alone: 0xC2 starts U+0080..U+00BF,
+// the Latin-1 punctuation and symbols, and 0xE2 starts U+2000..U+2FFF, with the typographic quotes and dashes.
+static inline int utf8_separator_length(unsigned char c) {
+    return c == 0xC2 ? 2 : c == 0xE2 ? 3 : 0;
+}
+
+// Sizes of the blocks of each kind, and the number of children they hold
+static const size_t childBlockSizes[CHILD_KINDS] = {0, sizeof(ChildBlock4), sizeof(ChildBlock16), sizeof(ChildBlock48), sizeof(ChildBlock256)};
+static const int childBlockLimits[CHILD_KINDS] = {0, 4, 16, 48, 256};
+
+// Getting the address of a block of children from its kind and its index in the pool of the kind.
+// A pool can move when a block of its kind is allocated, so the address is only used until then.
+static inline void *child_block(const Trie *trie, int kind, uint32_t block) {
+    char *blocks = __atomic_load_n(&trie->childPools[kind].blocks, __ATOMIC_ACQUIRE);
+    return blocks + (size_t)block * childBlockSizes[kind];
+}
+
+// Function to empty the pools of the blocks of children of a trie, keeping their memory
+static void reset_child_pools(Trie *trie) {
+    for (int kind = 0; kind < CHILD_KINDS; kind++) {
+        trie->childPools[kind].count = 0;
+        trie->childPools[kind].freeList = UINT32_MAX;
     }
-    new_node->checkisEndOfWord = false;
-    new_node->weight = 0;
-    for (int i = 0; i < Total_Alphabets; i++) {
-        new_node->children[i] = NULL;
+}
+
+// Function to free the pools of the blocks of children of a trie
+static void free_child_pools(Trie *trie) {
+    for (int kind = 0; kind < CHILD_KINDS; kind++) {
+        free(trie->childPools[kind].blocks);
+        trie->childPools[kind].blocks = NULL;
+        trie->childPools[kind].capacity = 0;
     }
-    return new_node;
+    reset_child_pools(trie);
 }
 
-// Insertion of a new word in the Trie
-void insert(TrieNode *root, const char *key) {
-    TrieNode *temp = root;
-    for (int i = 0; i < strlen(key); i++) {
-        int index = key[i] - 'a';
-        if (!temp->children[index]) {
-            temp->children[index] = create_node();
+// Retiring memory of a concurrent trie is defined with the readers it waits for
+static void retire_memory(RetireList *list, void *memory);
+
+// Function to get a block of the given kind, reusing a free one when there is one
+static uint32_t allocate_child_block(Trie *trie, int kind) {
+    ChildPool *pool = &trie->childPools[kind];
+    if (pool->freeList != UINT32_MAX) {
+        uint32_t block = pool->freeList;
+        // A free block holds the index of the next free block in its first bytes
+        memcpy(&pool->freeList, child_block(trie, kind, block), sizeof(uint32_t));
+        return block;
+    }
+    if (pool->count == pool->capacity) {
+        uint32_t newCapacity = pool->capacity ? pool->capacity * 2 : 256;
+        size_t bytes = (size_t)newCapacity * childBlockSizes[kind];
+        // Readers of a concurrent trie can still be in the old blocks, so they are copied instead of moved
+        char *blocks = trie->concurrent ? (char *)malloc(bytes) : (char *)realloc(pool->blocks, bytes);
+        if (blocks == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        if (trie->concurrent) {
+            char *old = pool->blocks;
+            if (old) memcpy(blocks, old, (size_t)pool->count * childBlockSizes[kind]);
+            __atomic_store_n(&pool->blocks, blocks, __ATOMIC_RELEASE);
+            retire_memory(&trie->retired, old);
+        } else {
+            pool->blocks = blocks;
         }
-        temp = temp->children[index];
+        pool->capacity = newCapacity;
     }
-    temp->checkisEndOfWord = true;
-    temp->weight++;
+    return pool->count++;
+}
+
+// Function to give a block back to the pool of its kind
+static void release_child_block(Trie *trie, int kind, uint32_t block) {
+    ChildPool *pool = &trie->childPools[kind];
+    memcpy(child_block(trie, kind, block), &pool->freeList, sizeof(uint32_t));
+    pool->freeList = block;
 }
 
-// Function to find the maximum weight in the Trie
-int findMaxWeight(TrieNode *node) {
-    if (node == NULL) return 0;
-    int maxWeight = node->weight;
-    for (int i = 0; i < Total_Alphabets; i++) {
-        if (node->children[i] != NULL) {
-            int childMaxWeight = findMaxWeight(node->children[i]);
-            if (childMaxWeight > maxWeight) {
-                maxWeight = childMaxWeight;
+// Epochs of the readers of concurrent tries. A thread reading one takes a slot the first time, and while
+// it reads its slot holds the global epoch of the time it started, 0 otherwise. Memory retired by a writer
+// is stamped with the global epoch, which is then advanced, and freed once every reader slot is either 0
+// or later than its stamp. The slots are apart so readers never write to the same cache line.
+#define MAX_READER_THREADS 256
+#define RETIRE_BATCH 64
+
+typedef struct ReaderSlot {
+    uint64_t epoch;
+    bool used;
+    char padding[64 - sizeof(uint64_t) - sizeof(bool)];
+} ReaderSlot;
+
+static ReaderSlot readerSlots[MAX_READER_THREADS] __attribute__((aligned(64)));
+static uint32_t readerSlotLimit;
+static uint64_t globalEpoch = 1;
+static _Thread_local int readerSlot = -1;
+static _Thread_local int readDepth;
+
+// Function to start reading concurrent tries in the calling thread. Everything a writer retires from
+// then on is kept until end_trie_read. Reads can be nested, only the outermost one counts.
+void begin_trie_read(void) {
+    if (readDepth++ > 0) return;
+    if (readerSlot < 0) {
+        for (int i = 0; i < MAX_READER_THREADS && readerSlot < 0; i++) {
+            bool expected = false;
+            if (__atomic_compare_exchange_n(&readerSlots[i].used, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                readerSlot = i;
             }
         }
+        if (readerSlot < 0) {
+            printf("Too many threads reading concurrent tries\n");
+            exit(1);
+        }
+        uint32_t limit = __atomic_load_n(&readerSlotLimit, __ATOMIC_RELAXED);
+        while (limit <= (uint32_t)readerSlot && !__atomic_compare_exchange_n(&readerSlotLimit, &limit, readerSlot + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        }
     }
-    return maxWeight;
+    // The slot is published before anything is read, so a writer either sees it or retired the memory
+    // before this read could reach it
+    __atomic_store_n(&readerSlots[readerSlot].epoch, __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
 }
 
+// Function to end a read started by begin_trie_read
+void end_trie_read(void) {
+    if (--readDepth > 0) return;
+    __atomic_store_n(&readerSlots[readerSlot].epoch, 0, __ATOMIC_RELEASE);
+}
 
-// Function to normalize the weights in the Trie
-void normalizeWeights(TrieNode *node, int maxWeight) {
-    if (node == NULL || maxWeight == 0) return;
-    
-    // Normalize and round to 4 decimal places
-    node->weight = round((double)node->weight / (maxWeight * 1.0) * 10000) / 10000.0;
-    
-    for (int i = 0; i < Total_Alphabets; i++) {
-        normalizeWeights(node->children[i], maxWeight);
-    }
+// Function to give back the reader slot of the calling thread, before a thread which read concurrent
+// tries ends
+void release_reader_slot(void) {
+    if (readerSlot < 0) return;
+    __atomic_store_n(&readerSlots[readerSlot].used, false, __ATOMIC_RELEASE);
+    readerSlot = -1;
 }
 
+// Function to free the retired memory no reader can still be going through
+static void reclaim_retired(RetireList *list) {
+    uint64_t oldest = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    uint32_t limit = __atomic_load_n(&readerSlotLimit, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < limit; i++) {
+        uint64_t epoch = __atomic_load_n(&readerSlots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch && epoch < oldest) oldest = epoch;
+    }
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < list->count; i++) {
+        RetiredMemory *item = &list->items[i];
+        if (item->epoch >= oldest) {
+            list->items[kept++] = *item;
+        } else if (item->memory) {
+            free(item->memory);
+        } else {
+            release_child_block(item->trie, item->kind, item->block);
+        }
+    }
+    list->count = kept;
+}
 
-// Function to get the combined weight of a word from two tries
-double getCombinedWeight(TrieNode *mainNode, TrieNode *corpusNode) {
-    double mainWeight = mainNode ? mainNode->weight : 0;
-    double corpusWeight = corpusNode ? corpusNode->weight : 0;
-    // Taking average of the weights if present in both tries
-    if (mainWeight > 0 && corpusWeight > 0) {
-        return (mainWeight + corpusWeight) / 2.0;  
-    } // If present in the main trie only,then double the weight to show its importance
-    else if (mainWeight > 0) {
-     
-        return mainWeight * 2;
-    } // If present in the corpus trie only, then return the weight of the corpus trie
-    else {
-        return corpusWeight; 
+// Function to add memory to the list of a concurrent trie, freeing what can be once enough is listed
+static void retire(RetireList *list, RetiredMemory item) {
+    if (list->count == list->capacity) {
+        // Memory retired while a reader is slow is kept, so the list grows instead of waiting for it
+        if (list->count >= RETIRE_BATCH) reclaim_retired(list);
+        if (list->count == list->capacity) {
+            uint32_t capacity = list->capacity ? list->capacity * 2 : RETIRE_BATCH;
+            RetiredMemory *items = (RetiredMemory *)realloc(list->items, capacity * sizeof(RetiredMemory));
+            if (items == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            list->items = items;
+            list->capacity = capacity;
+        }
     }
+    item.epoch = __atomic_fetch_add(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+    list->items[list->count++] = item;
 }
 
-// Suggesting words based on the prefix and the weights for the purpose of auto-fill
-void suggestWords(TrieNode *corpusTrie, TrieNode *mainTrie, char *prefix, char suggestions[][MAX_WORD_LENGTH], double weights[], int *suggestionCount, int maxSuggestions) {
+static void retire_memory(RetireList *list, void *memory) {
+    if (memory == NULL) return;
+    RetiredMemory item = {memory, NULL, 0, 0, 0};
+    retire(list, item);
+}
 
-    if (*suggestionCount >= maxSuggestions) return;
+static void retire_child_block(Trie *trie, int kind, uint32_t block) {
+    RetiredMemory item = {NULL, trie, block, (uint8_t)kind, 0};
+    retire(&trie->retired, item);
+}
 
+// Function to free the retired memory of a trie, once no thread reads it any more
+static void free_retired(RetireList *list) {
+    for (uint32_t i = 0; i < list->count; i++) {
+        free(list->items[i].memory);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
 
-    if ((corpusTrie && corpusTrie->checkisEndOfWord) || (mainTrie && mainTrie->checkisEndOfWord)) {
-        if (*suggestionCount < maxSuggestions) {
-            double combinedWeight = getCombinedWeight(mainTrie, corpusTrie);
-            // This strcpy function is used to copy the prefix to the suggestions array
-            strcpy(suggestions[*suggestionCount], prefix);
-            weights[*suggestionCount] = combinedWeight;
-            (*suggestionCount)++;
-        }
+// Function to find the position of a label among count labels, or -1 if it is not there
+static inline int find_label(const uint8_t *labels, int count, unsigned char label) {
+    int i = 0;
+#ifdef __SSE2__
+    // Comparing 16 labels at once while 16 of them are left
+    const __m128i wanted = _mm_set1_epi8((char)label);
+    for (; i + 16 <= count; i += 16) {
+        int found = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(labels + i)), wanted));
+        if (found) return i + __builtin_ctz(found);
+    }
+#endif
+    for (; i < count; i++) {
+        if (labels[i] == label) return i;
     }
+    return -1;
+}
 
-    // Now we will iterate over all the alphabets and call the suggestWords function recursively
-    for (int i = 0; i < Total_Alphabets; i++) {
-        if ((corpusTrie && corpusTrie->children[i]) || (mainTrie && mainTrie->children[i])) {
-            char nextPrefix[MAX_WORD_LENGTH];
-            sprintf(nextPrefix, "%s%c", prefix, 'a' + i);
+// Function to find the position of a label in a block of 16 children, or -1 if it is not there
+static inline int find_label16(const ChildBlock16 *block, int count, unsigned char label) {
+#ifdef __SSE2__
+    // The whole block is compared at once, ignoring the unused labels
+    int found = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)block->labels), _mm_set1_epi8((char)label)));
+    found &= (1 << count) - 1;
+    return found ? __builtin_ctz(found) : -1;
+#else
+    return find_label(block->labels, count, label);
+#endif
+}
 
-            TrieNode *nextCorpusTrie = corpusTrie && corpusTrie->children[i] ? corpusTrie->children[i] : NULL;
-            TrieNode *nextMainTrie = mainTrie && mainTrie->children[i] ? mainTrie->children[i] : NULL;
+// Getting the block, count and kind of the children of a node as they were at one time
+static inline ChildLink load_child_link(const TrieNode *node) {
+    ChildLink link;
+    link.word = __atomic_load_n(&node->childLink.word, __ATOMIC_ACQUIRE);
+    return link;
+}
 
-          
-            suggestWords(nextCorpusTrie, nextMainTrie, nextPrefix, suggestions, weights, suggestionCount, maxSuggestions);
+// Getting the child of a node of a trie which is not frozen for the given label, or NULL_NODE if it has none
+static inline NodeId node_child(const Trie *trie, const TrieNode *node, unsigned char label) {
+    ChildLink link = load_child_link(node);
+    switch (link.kind) {
+        case CHILDREN_4: {
+            const ChildBlock4 *block = (const ChildBlock4 *)child_block(trie, CHILDREN_4, link.block);
+            int pos = find_label(block->labels, link.count, label);
+            return pos < 0 ? NULL_NODE : block->children[pos];
         }
+        case CHILDREN_16: {
+            const ChildBlock16 *block = (const ChildBlock16 *)child_block(trie, CHILDREN_16, link.block);
+            int pos = find_label16(block, link.count, label);
+            return pos < 0 ? NULL_NODE : block->children[pos];
+        }
+        case CHILDREN_48: {
+            const ChildBlock48 *block = (const ChildBlock48 *)child_block(trie, CHILDREN_48, link.block);
+            int pos = __atomic_load_n(&block->positions[label], __ATOMIC_ACQUIRE);
+            return pos ? block->children[pos - 1] : NULL_NODE;
+        }
+        case CHILDREN_256: {
+            const ChildBlock256 *block = (const ChildBlock256 *)child_block(trie, CHILDREN_256, link.block);
+            return __atomic_load_n(&block->children[label], __ATOMIC_ACQUIRE);
+        }
+        default:
+            return NULL_NODE;
     }
 }
 
-// Function to find the prefix node of a word in the Trie
-TrieNode* findPrefixNode(TrieNode *root, const char *prefix) {
-    TrieNode *current = root;
-    while (*prefix) {
-        int index = *prefix - 'a';
-        if (!current->children[index]) {
-            return NULL;
+// Function to copy the children of a node to a new block of the given kind, which is the kind of their
+// block or the next one once it is full, returning the new block
+static uint32_t copy_children(Trie *trie, ChildLink link, int kind) {
+    uint32_t block = allocate_child_block(trie, kind);
+    void *to = child_block(trie, kind, block);
+    const void *from = link.kind != CHILDREN_NONE ? child_block(trie, link.kind, link.block) : NULL;
+    int count = link.count;
+    if (kind == link.kind) {
+        memcpy(to, from, childBlockSizes[kind]);
+    } else if (link.kind == CHILDREN_4) {
+        ChildBlock16 *grown = (ChildBlock16 *)to;
+        memcpy(grown->labels, ((const ChildBlock4 *)from)->labels, count);
+        memcpy(grown->children, ((const ChildBlock4 *)from)->children, count * sizeof(NodeId));
+    } else if (link.kind == CHILDREN_16) {
+        ChildBlock48 *grown = (ChildBlock48 *)to;
+        memset(grown->positions, 0, sizeof(grown->positions));
+        for (int i = 0; i < count; i++) {
+            grown->positions[((const ChildBlock16 *)from)->labels[i]] = i + 1;
+            grown->children[i] = ((const ChildBlock16 *)from)->children[i];
+        }
+    } else if (link.kind == CHILDREN_48) {
+        ChildBlock256 *grown = (ChildBlock256 *)to;
+        const ChildBlock48 *old = (const ChildBlock48 *)from;
+        for (int label = 0; label < 256; label++) {
+            grown->children[label] = old->positions[label] ? old->children[old->positions[label] - 1] : NULL_NODE;
         }
-        current = current->children[index];
-        prefix++;
     }
-    return current;
+    return block;
 }
 
-// Function to calculate the Levenshtein distance between two strings using dynamic programming
-int levenshtein_distance(const char *s1, const char *s2) {
-    int len1 = strlen(s1);
-    int len2 = strlen(s2);
-    int **d = (int **)malloc((len1 + 1) * sizeof(int *));
-    for (int i = 0; i <= len1; i++)
-        d[i] = (int *)malloc((len2 + 1) * sizeof(int));
+// Function to add a child with a label the node has no child for yet. The child is in its block before
+// the node links to it, so a reader of a concurrent trie finds the children either before or after it.
+static void add_child(Trie *trie, NodeId parent, unsigned char label, NodeId child) {
+    // Slabs never move, so the node stays valid while blocks are allocated
+    TrieNode *node = get_node(trie, parent);
+    ChildLink link = node->childLink;
+    ChildLink updated = link;
+    // A full block is replaced by a block of the next kind. Adding a child shifts the sorted labels of
+    // a block of 4 or 16, which a concurrent trie does in a copy of the block.
+    if (link.count == childBlockLimits[link.kind]) updated.kind++;
+    if (updated.kind != link.kind || (trie->concurrent && updated.kind <= CHILDREN_16)) {
+        updated.block = copy_children(trie, link, updated.kind);
+    }
+    int count = link.count;
+    void *block = child_block(trie, updated.kind, updated.block);
+    if (updated.kind == CHILDREN_4 || updated.kind == CHILDREN_16) {
+        // Keeping the labels sorted, so the children are listed in label order
+        uint8_t *labels = updated.kind == CHILDREN_4 ? ((ChildBlock4 *)block)->labels : ((ChildBlock16 *)block)->labels;
+        NodeId *children = updated.kind == CHILDREN_4 ? ((ChildBlock4 *)block)->children : ((ChildBlock16 *)block)->children;
+        int pos = count;
+        while (pos > 0 && labels[pos - 1] > label) {
+            labels[pos] = labels[pos - 1];
+            children[pos] = children[pos - 1];
+            pos--;
+        }
+        labels[pos] = label;
+        children[pos] = child;
+    } else if (updated.kind == CHILDREN_48) {
+        ((ChildBlock48 *)block)->children[count] = child;
+        __atomic_store_n(&((ChildBlock48 *)block)->positions[label], (uint8_t)(count + 1), __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&((ChildBlock256 *)block)->children[label], child, __ATOMIC_RELEASE);
+    }
+    updated.count++;
+    __atomic_store_n(&node->childLink.word, updated.word, __ATOMIC_RELEASE);
+    if (link.kind != CHILDREN_NONE && updated.block != link.block) {
+        if (trie->concurrent) {
+            retire_child_block(trie, link.kind, link.block);
+        } else {
+            release_child_block(trie, link.kind, link.block);
+        }
+    }
+}
 
-    for (int i = 0; i <= len1; i++) d[i][0] = i;
-    for (int j = 0; j <= len2; j++) d[0][j] = j;
+// Getting the node at the end of the edge a position of a trie lies on. Outside radix tries every
+// position is a node.
+static inline NodeId trie_edge_node(const Trie *trie, NodeId position) {
+    return trie->radix ? position & RADIX_NODE_MASK : position;
+}
 
-    for (int i = 1; i <= len1; i++) {
-        for (int j = 1; j <= len2; j++) {
-            int cost = (s1[i - 1] == s2[j - 1]) ? 0 : 1;
-            d[i][j] = fmin(fmin(d[i - 1][j] + 1, d[i][j - 1] + 1), d[i - 1][j - 1] + cost);
-        }
+// Getting the number of letters left on the edge of a radix trie before its node is reached, with
+// the letters themselves in rest. It is 0 at a node and in any other trie.
+static inline int trie_edge_rest(const Trie *trie, NodeId position, const uint8_t **rest) {
+    int left = trie->radix ? (int)(position >> RADIX_NODE_BITS) : 0;
+    if (left) {
+        NodeId node = position & RADIX_NODE_MASK;
+        *rest = trie->edges + trie->edgeStart[node] + trie->edgeLength[node] - left;
     }
-    int distance = d[len1][len2];
-    for (int i = 0; i <= len1; i++) free(d[i]);
-    free(d);
-    return distance;
+    return left;
 }
 
-// Function to find or update existing suggestion, averaging the weight if found for the correction purpose
-int find_or_update_suggestion(Suggestion *suggestions, int *count, const char *word, double new_score) {
-    for (int i = 0; i < *count; i++) {
-        // This strcmp function is used to compare the two strings
-        if (strcmp(suggestions[i].word, word) == 0) {
-            if (!suggestions[i].combined) {
-                suggestions[i].score = (suggestions[i].score + new_score) / 2;
-                suggestions[i].combined = true;
-            }
-            return i;
+// Getting the position reached from the first letter of the edge of a child of a radix trie
+static inline NodeId radix_edge_position(const Trie *trie, NodeId child) {
+    return child | (NodeId)(trie->edgeLength[child] - 1) << RADIX_NODE_BITS;
+}
+
+// Getting the child of a node for the given label, or NULL_NODE if it has none. In a radix trie, the
+// node can be a position on an edge, and the child is then the position one letter further.
+static inline NodeId trie_child(const Trie *trie, NodeId node, unsigned char label) {
+    if (trie->frozen) {
+        const uint8_t *rest = NULL;
+        if (trie_edge_rest(trie, node, &rest)) {
+            return *rest == label ? node - (1u << RADIX_NODE_BITS) : NULL_NODE;
         }
+        NodeId first = trie->firstChild[node];
+        int pos = find_label(trie->labels + first, trie->childCount[node] & FROZEN_CHILD_COUNT, label);
+        if (pos < 0) return NULL_NODE;
+        return trie->radix ? radix_edge_position(trie, first + pos) : first + pos;
     }
-    return -1;
+    return node_child(trie, get_node(trie, node), label);
 }
 
-// Recursive function to collect suggestions of the same length for the purpose of auto-correct
-void collect_suggestions(TrieNode *root, char *prefix, int level, Suggestion *suggestions, int *count, const char *input, double alpha, double max_weight, int target_length) {
-    if (root == NULL) return;
-
-    if (root->checkisEndOfWord && level == target_length) {
-        int lev_dist = levenshtein_distance(prefix, input);
-        if (lev_dist <= LEVENSHTEIN_LIMIT) {
-            double normalized_weight = (double)root->weight / max_weight;
-            double score = alpha * (1.0 / (lev_dist + 1)) + (1 - alpha) * normalized_weight;
-            int index = find_or_update_suggestion(suggestions, count, prefix, score);
-            if (index == -1) {
-                strcpy(suggestions[*count].word, prefix);
-                suggestions[*count].score = score;
-                suggestions[*count].combined = false;
-                (*count)++;
-            }
+// Function to step through the children of a node in label order. cursor starts at 0, and every call
+// gives the next child and its label, until it returns false once they were all given.
+static inline bool trie_next_child(const Trie *trie, NodeId node, int *cursor, unsigned char *label, NodeId *child) {
+    if (trie->frozen) {
+        const uint8_t *rest = NULL;
+        if (trie_edge_rest(trie, node, &rest)) {
+            // A position on an edge has the next letter of the edge as its only child
+            if (*cursor > 0) return false;
+            *label = *rest;
+            *child = node - (1u << RADIX_NODE_BITS);
+            (*cursor)++;
+            return true;
         }
+        if (*cursor >= (int)(trie->childCount[node] & FROZEN_CHILD_COUNT)) return false;
+        *child = trie->firstChild[node] + *cursor;
+        *label = trie->labels[*child];
+        if (trie->radix) *child = radix_edge_position(trie, *child);
+        (*cursor)++;
+        return true;
     }
-    // If the level is less than the target length, then we will iterate over all the alphabets
-    if (level < target_length) {
-        for (int i = 0; i < Total_Alphabets; i++) {
-            if (root->children[i]) {
-                prefix[level] = 'a' + i;
-                prefix[level + 1] = '\0';
-                collect_suggestions(root->children[i], prefix, level + 1, suggestions, count, input, alpha, max_weight, target_length);
-                prefix[level] = '\0';
-            }
+    // Outside frozen tries, cursor holds the smallest label not given yet in its low 9 bits and the
+    // position of that label among the labels of a block of 4 or 16 above them. Children can be added
+    // to a concurrent trie between two calls, so the position is checked and moved past them.
+    ChildLink link = load_child_link(get_node(trie, node));
+    const void *block = link.kind != CHILDREN_NONE ? child_block(trie, link.kind, link.block) : NULL;
+    int from = *cursor & 0x1FF;
+    switch (link.kind) {
+        case CHILDREN_4:
+        case CHILDREN_16: {
+            const uint8_t *labels = link.kind == CHILDREN_4 ? ((const ChildBlock4 *)block)->labels : ((const ChildBlock16 *)block)->labels;
+            const NodeId *children = link.kind == CHILDREN_4 ? ((const ChildBlock4 *)block)->children : ((const ChildBlock16 *)block)->children;
+            int pos = *cursor >> 9;
+            while (pos < link.count && labels[pos] < from) pos++;
+            if (pos >= link.count) return false;
+            *label = labels[pos];
+            *child = children[pos];
+            *cursor = (pos + 1) << 9 | (labels[pos] + 1);
+            return true;
         }
+        case CHILDREN_48:
+            for (; from < 256; from++) {
+                int pos = __atomic_load_n(&((const ChildBlock48 *)block)->positions[from], __ATOMIC_ACQUIRE);
+                if (pos) {
+                    *label = from;
+                    *child = ((const ChildBlock48 *)block)->children[pos - 1];
+                    *cursor = from + 1;
+                    return true;
+                }
+            }
+            return false;
+        case CHILDREN_256:
+            for (; from < 256; from++) {
+                NodeId found = __atomic_load_n(&((const ChildBlock256 *)block)->children[from], __ATOMIC_ACQUIRE);
+                if (found) {
+                    *label = from;
+                    *child = found;
+                    *cursor = from + 1;
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
     }
 }
 
-// Function to suggest words based on combined score and matching length for the purpose of auto-correct
-void suggest_words_for_correction(TrieNode *currentTrie, TrieNode *pastTrie, const char *input, double alpha) {
-    Suggestion suggestions[1000];
-    int count = 0;
-    char prefix[MAX_WORD_LENGTH] = "";
-    int input_length = strlen(input);
+// Checking whether a node marks the end of a word. No word ends inside an edge of a radix trie.
+static inline bool trie_is_end(const Trie *trie, NodeId node) {
+    if (trie->frozen) {
+        if (trie->radix && node > RADIX_NODE_MASK) return false;
+        return (trie->childCount[node] & FROZEN_END_OF_WORD) != 0;
+    }
+    return SHARED_LOAD(get_node(trie, node)->checkisEndOfWord);
+}
 
-    double max_weight_current = 1.0, max_weight_past = 1.0;
+// Getting the raw count stored at a node
+static inline uint32_t trie_count(const Trie *trie, NodeId node) {
+    if (trie->frozen) {
+        if (trie->radix && node > RADIX_NODE_MASK) return 0;
+        return trie->weights[node];
+    }
+    return SHARED_LOAD(get_node(trie, node)->weight);
+}
 
-    // Getting the maximum weight for normalization
-    max_weight_current = currentTrie->weight ? currentTrie->weight : 1.0;
-    max_weight_past = pastTrie->weight ? pastTrie->weight : 1.0;
+// Getting the highest raw count of any word ending at a node or below it. The words below a position
+// on an edge are the ones below the node of the edge.
+static inline uint32_t trie_subtree_count(const Trie *trie, NodeId node) {
+    if (trie->frozen) return trie->subtreeMax[trie_edge_node(trie, node)];
+    return SHARED_LOAD(get_node(trie, node)->subtreeMax);
+}
 
-    // Collecting suggestions of the same length as the input word
-    collect_suggestions(currentTrie, prefix, 0, suggestions, &count, input, alpha, max_weight_current, input_length);
-    collect_suggestions(pastTrie, prefix, 0, suggestions, &count, input, alpha, max_weight_past, input_length);
+// Function to normalize a raw count by the highest count of its trie, rounded to 4 decimal places
+static inline double normalize_weight(uint32_t weight, uint32_t maxWeight) {
+    if (maxWeight == 0) return 0;
+    return round((double)weight / maxWeight * 10000) / 10000.0;
+}
 
-    // Sorting the  suggestions based on score
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = i + 1; j < count; j++) {
-            if (suggestions[i].score < suggestions[j].score) {
-                Suggestion temp = suggestions[i];
-                suggestions[i] = suggestions[j];
-                suggestions[j] = temp;
-            }
-        }
+// Half-life of the recency of the words typed by the user, in seconds. It is set by --half-life, and
+// 0 stops the decay.
+double recencyHalfLife = RECENCY_HALF_LIFE;
+
+// Function to get the current time of the recency counts
+static inline uint32_t recency_now(void) {
+    return (uint32_t)time(NULL);
+}
+
+// Function to get the value a recency count has decayed to at a later or earlier time
+static inline double recency_at(Recency recency, uint32_t time) {
+    if (recencyHalfLife <= 0) return recency.value;
+    return recency.value * exp2(((double)recency.time - time) / recencyHalfLife);
+}
+
+// Function to count one more use at the given time
+static inline Recency recency_add(Recency recency, uint32_t time) {
+    // A count already more recent than the time, such as one replayed from a log, is not decayed back
+    uint32_t later = time > recency.time ? time : recency.time;
+    Recency updated = {(float)(recency_at(recency, later) + 1.0), later};
+    return updated;
+}
+
+// Function to check if a recency count is greater than another, both decayed to the same time
+static inline bool recency_greater(Recency a, Recency b) {
+    if (a.time >= b.time) return a.value > recency_at(b, a.time);
+    return recency_at(a, b.time) > b.value;
+}
+
+// Function to normalize a recency count by the highest one of its trie, rounded to 4 decimal places.
+// Both decay at the same rate, so the result does not depend on the current time.
+static inline double normalize_recency(Recency recency, Recency maxRecency) {
+    if (maxRecency.value <= 0) return 0;
+    return round(recency_at(recency, maxRecency.time) / maxRecency.value * 10000) / 10000.0;
+}
+
+// Getting the recency count of the word ending at a node
+static inline Recency trie_recency(const Trie *trie, NodeId node) {
+    if (trie->frozen) {
+        Recency none = {0, 0};
+        if (trie->radix && node > RADIX_NODE_MASK) return none;
+        return trie->recency ? trie->recency[node] : none;
     }
-    // Checking if the suggestions are found or not
-    if(suggestions[0].score == 0){
-        printf("No suggestions found for '%s'\n", input);
-        return;
+    return load_recency(&get_node(trie, node)->recency);
+}
+
+// Getting the highest recency count of any word ending at a node or below it
+static inline Recency trie_subtree_recency(const Trie *trie, NodeId node) {
+    if (trie->frozen) {
+        Recency none = {0, 0};
+        return trie->subtreeRecency ? trie->subtreeRecency[trie_edge_node(trie, node)] : none;
     }
+    return load_recency(&get_node(trie, node)->subtreeRecency);
+}
 
-    printf("Suggestions for '%s':\n", input);
-    for (int i = 0; i < count; i++) {
-        printf("%s (Score: %.2f)\n", suggestions[i].word, suggestions[i].score);
+// Getting the normalized weight of the word ending at a node, from its decayed count when the trie has them
+static inline double trie_weight(const Trie *trie, NodeId node) {
+    if (SHARED_LOAD(trie->hasRecency)) {
+        return normalize_recency(trie_recency(trie, node), trie_subtree_recency(trie, trie->root));
     }
+    return normalize_weight(trie_count(trie, node), SHARED_LOAD(trie->maxWeight));
 }
 
+// Getting the highest normalized weight of any word ending at a node or below it. Rounding keeps the
+// order of the weights, so this is exactly the weight of the best word below.
+static inline double trie_subtree_max(const Trie *trie, NodeId node) {
+    if (SHARED_LOAD(trie->hasRecency)) {
+        return normalize_recency(trie_subtree_recency(trie, node), trie_subtree_recency(trie, trie->root));
+    }
+    return normalize_weight(trie_subtree_count(trie, node), SHARED_LOAD(trie->maxWeight));
+}
 
-// Function to clean and insert a word from a file character by character
-void insert_from_file(TrieNode *root, FILE *f) {
-    char word[MAX_WORD_LENGTH];
-    int j = 0;
-    char ch;
-    // Reading the file character by character
-    while ((ch = fgetc(f)) != EOF) {
-        if (isalpha(ch)) {  
-            word[j++] = tolower(ch);
-        } else {
-            if (j > 0) {  
-                word[j] = '\0'; 
-                insert(root, word); 
-                j = 0;  
-            }
-        }
+// The hash of a word is defined with the SymSpell index, which uses it for its deletion variants
+static uint64_t hash_word(const char *word, int length);
+
+// Function to mix two hashes into the fingerprint of the pair, never 0
+static inline uint64_t mix_hashes(uint64_t a, uint64_t b) {
+    uint64_t x = a * 0x9E3779B97F4A7C15ULL ^ (b + 0x632BE59BD9B4E019ULL + (a << 6) + (a >> 2));
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 29;
+    return x ? x : 1;
+}
+
+// Function to get the fingerprint of a trigram, kept apart from the fingerprints of the bigrams
+static inline uint64_t trigram_key(uint64_t a, uint64_t b, uint64_t c) {
+    return mix_hashes(mix_hashes(a, b) ^ 0xD6E8FEB86659FD93ULL, c);
+}
+
+// Function to quantize a count to a byte on a logarithmic scale, 8 steps for every doubling
+static inline uint8_t quantize_count(uint32_t count) {
+    if (count == 0) return 0;
+    long level = 1 + lround(8 * log2((double)count));
+    return level > 255 ? 255 : (uint8_t)level;
+}
+
+// Function to get back the approximate count of a quantized count
+static inline double dequantize_count(uint8_t level) {
+    return level ? exp2((level - 1) / 8.0) : 0;
+}
+
+// Initializing an empty n-gram model
+void init_ngrams(NgramModel *model) {
+    memset(model, 0, sizeof(*model));
+}
+
+// Function to free the memory of an n-gram model and leave it empty
+void free_ngrams(NgramModel *model) {
+    free(model->bigrams);
+    free(model->trigrams);
+    free(model->keys);
+    free(model->levels);
+    free(model->followers);
+    free(model->words);
+    init_ngrams(model);
+}
+
+// Function to forget every n-gram of a model which is not frozen, keeping its tables for the next text
+void clear_ngrams(NgramModel *model) {
+    if (model->bigramCount) {
+        memset(model->bigrams, 0, model->bigramSlots * sizeof(NgramBigram));
+        model->bigramCount = 0;
     }
-    if (j > 0) {
-        word[j] = '\0';
-        insert(root, word);
+    if (model->trigramCount) {
+        memset(model->trigrams, 0, model->trigramSlots * sizeof(NgramTrigram));
+        model->trigramCount = 0;
     }
+    model->previousCount = 0;
+    model->firstCount = 0;
 }
-// Sorting the suggestions based on the weights for the purpose of auto-fill
-void sortSuggestions(char suggestions[][MAX_WORD_LENGTH], double weights[], int count) {
- 
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = i + 1; j < count; j++) {
-            if (weights[i] < weights[j]) {
-                double tempWeight = weights[i];
-                weights[i] = weights[j];
-                weights[j] = tempWeight;
-                
-                char tempWord[MAX_WORD_LENGTH];
-                strcpy(tempWord, suggestions[i]);
-                strcpy(suggestions[i], suggestions[j]);
-                strcpy(suggestions[j], tempWord);
-                
-            }
-        }
+
+// Function to start a new text, whose first word follows no word of the previous text
+void ngram_new_text(NgramModel *model) {
+    model->previousCount = 0;
+}
+
+// Function to get the slot of a bigram in a table of a model being built, which is either the slot
+// holding it or the empty slot where it belongs. A bigram is filled in before its first word is set,
+// so a reader of a concurrent trie which sees the first word sees the rest too.
+static uint32_t find_bigram_slot(const NgramBigram *bigrams, uint32_t slots, uint64_t first, uint64_t second) {
+    uint32_t mask = slots - 1;
+    uint32_t slot = (uint32_t)mix_hashes(first, second) & mask;
+    for (;;) {
+        uint64_t found = __atomic_load_n(&bigrams[slot].first, __ATOMIC_ACQUIRE);
+        if (!found || (found == first && bigrams[slot].second == second)) return slot;
+        slot = (slot + 1) & mask;
     }
 }
 
-// Free Trie memory
-void free_trie(TrieNode *root) {
-    if (root == NULL) return;
+// Function to get the slot of a trigram in a table of a model being built
+static uint32_t find_trigram_slot(const NgramTrigram *trigrams, uint32_t slots, uint64_t key) {
+    uint32_t mask = slots - 1;
+    uint32_t slot = (uint32_t)key & mask;
+    for (;;) {
+        uint64_t found = __atomic_load_n(&trigrams[slot].key, __ATOMIC_ACQUIRE);
+        if (!found || found == key) return slot;
+        slot = (slot + 1) & mask;
+    }
+}
 
-    for (int i = 0; i < Total_Alphabets; i++) {
-        if (root->children[i] != NULL) {
-            free_trie(root->children[i]);
-        }
+// Function to replace the bigram or the trigram table of a model with a bigger one. The sequence of the
+// model is odd meanwhile, so readers of a concurrent trie know to read the table and its size again.
+static void begin_table_change(NgramModel *model) {
+    __atomic_store_n(&model->tableSequence, model->tableSequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_table_change(NgramModel *model, void *old) {
+    __atomic_store_n(&model->tableSequence, model->tableSequence + 1, __ATOMIC_RELEASE);
+    if (model->retired) {
+        retire_memory(model->retired, old);
+    } else {
+        free(old);
     }
-    free(root);
 }
 
-// Main function which performs the auto-fill and auto-correct functionalities
-int main() {
-    TrieNode *root = create_node();
-    TrieNode *mainTrieRoot = create_node();
+// Function to get the bigram table of a model being built with its number of slots, read while the
+// writer of a concurrent trie is not replacing it
+static const NgramBigram *load_bigrams(const NgramModel *model, uint32_t *slots) {
+    for (;;) {
+        uint32_t sequence = __atomic_load_n(&model->tableSequence, __ATOMIC_ACQUIRE);
+        const NgramBigram *bigrams = SHARED_LOAD(model->bigrams);
+        *slots = SHARED_LOAD(model->bigramSlots);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(sequence & 1) && SHARED_LOAD(model->tableSequence) == sequence) return bigrams;
+    }
+}
 
-    // Loading the corpus data from the file
-    FILE *f = fopen("corpus_sample.txt", "r");
-    if (!f) {
-        printf("Error opening file\n");
-        return 1;
+static const NgramTrigram *load_trigrams(const NgramModel *model, uint32_t *slots) {
+    for (;;) {
+        uint32_t sequence = __atomic_load_n(&model->tableSequence, __ATOMIC_ACQUIRE);
+        const NgramTrigram *trigrams = SHARED_LOAD(model->trigrams);
+        *slots = SHARED_LOAD(model->trigramSlots);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(sequence & 1) && SHARED_LOAD(model->tableSequence) == sequence) return trigrams;
     }
-    insert_from_file(root, f);
-    fclose(f);
+}
 
-    // Gettting a choice from the user for auto-fill or auto-correct
-    char choice;
-    printf("Enter 'f' for Auto-fill and 'c' for Auto-correct: ");
-    scanf(" %c", &choice);
-    // Clear the newline left in the input buffer by scanf
-    getchar(); 
+// Function to double the bigram table of a model being built, keeping it at most half full
+static void grow_bigrams(NgramModel *model) {
+    uint32_t slots = model->bigramSlots ? model->bigramSlots * 2 : 1024;
+    NgramBigram *bigrams = (NgramBigram *)calloc(slots, sizeof(NgramBigram));
+    if (bigrams == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < model->bigramSlots; i++) {
+        if (!model->bigrams[i].first) continue;
+        bigrams[find_bigram_slot(bigrams, slots, model->bigrams[i].first, model->bigrams[i].second)] = model->bigrams[i];
+    }
+    NgramBigram *old = model->bigrams;
+    begin_table_change(model);
+    SHARED_STORE(model->bigrams, bigrams);
+    SHARED_STORE(model->bigramSlots, slots);
+    end_table_change(model, old);
+}
+
+// Function to double the trigram table of a model being built
+static void grow_trigrams(NgramModel *model) {
+    uint32_t slots = model->trigramSlots ? model->trigramSlots * 2 : 1024;
+    NgramTrigram *trigrams = (NgramTrigram *)calloc(slots, sizeof(NgramTrigram));
+    if (trigrams == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < model->trigramSlots; i++) {
+        if (!model->trigrams[i].key) continue;
+        trigrams[find_trigram_slot(trigrams, slots, model->trigrams[i].key)] = model->trigrams[i];
+    }
+    NgramTrigram *old = model->trigrams;
+    begin_table_change(model);
+    SHARED_STORE(model->trigrams, trigrams);
+    SHARED_STORE(model->trigramSlots, slots);
+    end_table_change(model, old);
+}
 
-    // Getting a input sentence from the user
-    char sentence[MAX_WORD_LENGTH * 10];
-    printf("Enter a sentence: ");
-    fgets(sentence, sizeof(sentence), stdin);
-    // Removing the newline character
-    sentence[strcspn(sentence, "\n")] = '\0';  
+// Function to add to the count of a bigram
+static void add_bigram(NgramModel *model, uint64_t first, uint64_t second, uint32_t amount) {
+    if ((model->bigramCount + 1) * 2 > model->bigramSlots) grow_bigrams(model);
+    NgramBigram *bigram = &model->bigrams[find_bigram_slot(model->bigrams, model->bigramSlots, first, second)];
+    if (!bigram->first) {
+        bigram->second = second;
+        bigram->count = amount;
+        __atomic_store_n(&bigram->first, first, __ATOMIC_RELEASE);
+        SHARED_STORE(model->bigramCount, model->bigramCount + 1);
+    } else {
+        SHARED_STORE(bigram->count, bigram->count + amount);
+    }
+}
 
-    // Processing the input sentence or the last word
-    char *token = strtok(sentence, " ");
-    char lastWord[MAX_WORD_LENGTH] = "";
+// Function to add to the count of a trigram
+static void add_trigram(NgramModel *model, uint64_t key, uint32_t amount) {
+    if ((model->trigramCount + 1) * 2 > model->trigramSlots) grow_trigrams(model);
+    NgramTrigram *trigram = &model->trigrams[find_trigram_slot(model->trigrams, model->trigramSlots, key)];
+    if (!trigram->key) {
+        trigram->count = amount;
+        __atomic_store_n(&trigram->key, key, __ATOMIC_RELEASE);
+        SHARED_STORE(model->trigramCount, model->trigramCount + 1);
+    } else {
+        SHARED_STORE(trigram->count, trigram->count + amount);
+    }
+}
+
+// Function to count the bigram and the trigram ending at the next word of a text, given the hash of the word
+void ngram_add_word(NgramModel *model, uint64_t word) {
+    if (model->previousCount >= 1) {
+        add_bigram(model, model->previous[1], word, 1);
+    }
+    if (model->previousCount >= 2) {
+        add_trigram(model, trigram_key(model->previous[0], model->previous[1], word), 1);
+    }
+    SHARED_STORE(model->previous[0], model->previous[1]);
+    SHARED_STORE(model->previous[1], word);
+    if (model->previousCount < 2) SHARED_STORE(model->previousCount, model->previousCount + 1);
+    if (model->firstCount < 2) model->first[model->firstCount++] = word;
+}
+
+// Function to copy the last words added to a model, which the next word follows, returning how many there are
+static int ngram_context(const NgramModel *model, uint64_t *context) {
+    int count = SHARED_LOAD(model->previousCount);
+    for (int i = 0; i < count; i++) {
+        context[i] = SHARED_LOAD(model->previous[2 - count + i]);
+    }
+    return count;
+}
 
-    while (token != NULL) {
-        // Converting to lowercase
-        for (int i = 0; token[i]; i++) {
-            token[i] = tolower(token[i]);
+// Function to add the counts of a model of the text following the one of another model, counting
+// also the n-grams which start in the first text and end in the second
+void merge_ngrams(NgramModel *into, const NgramModel *from) {
+    for (int j = 0; j < from->firstCount; j++) {
+        uint64_t word = from->first[j];
+        // The bigram ending at the second word of the following text lies inside it
+        if (j == 0 && into->previousCount >= 1) {
+            add_bigram(into, into->previous[1], word, 1);
         }
-        char *nextToken = strtok(NULL, " ");
-        if (nextToken != NULL) {
-            insert(mainTrieRoot, token);
-        } else {
-            strcpy(lastWord, token);
+        // After the first word is added, the context of the second starts in the first text only if
+        // that text had a word
+        if (into->previousCount >= 2) {
+            add_trigram(into, trigram_key(into->previous[0], into->previous[1], word), 1);
         }
-        token = nextToken;
+        into->previous[0] = into->previous[1];
+        into->previous[1] = word;
+        if (into->previousCount < 2) into->previousCount++;
+        if (into->firstCount < 2) into->first[into->firstCount++] = word;
     }
-    // Checking if the last word is valid or not
-    if (strlen(lastWord) == 0) {
-        printf("No valid last word entered.\n");
-        return 0;
+    if (from->previousCount == 2) {
+        into->previous[0] = from->previous[0];
+        into->previous[1] = from->previous[1];
+    }
+    for (uint32_t i = 0; i < from->bigramSlots; i++) {
+        if (from->bigrams[i].first) add_bigram(into, from->bigrams[i].first, from->bigrams[i].second, from->bigrams[i].count);
     }
+    for (uint32_t i = 0; i < from->trigramSlots; i++) {
+        if (from->trigrams[i].key) add_trigram(into, from->trigrams[i].key, from->trigrams[i].count);
+    }
+}
 
-    // Normalizing the weights in the Trie
-    int maxWeight1 = findMaxWeight(root);
-    int maxWeight2 = findMaxWeight(mainTrieRoot);
-    normalizeWeights(root, maxWeight1);
-    normalizeWeights(mainTrieRoot, maxWeight2);
+// Structure of the best next words of a word while they are chosen, with their counts and the count
+// of every bigram starting with the word
+typedef struct FollowerChoice {
+    uint64_t word;
+    uint64_t next[NGRAM_FOLLOWERS];
+    uint32_t counts[NGRAM_FOLLOWERS];
+    uint32_t total;
+} FollowerChoice;
 
-    if (choice == 'f') {
-        // Auto-fill functionality
-        TrieNode *prefixCorpusNode = findPrefixNode(root, lastWord);
-        TrieNode *prefixMainNode = findPrefixNode(mainTrieRoot, lastWord);
-        if (prefixCorpusNode || prefixMainNode) {
-            char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-            double weights[MAX_SUGGESTIONS] = {0};
-            int suggestionCount = 0;
+// Function to check if a next word of the given count and hash ranks before another: higher count
+// first, then lower hash, so the choice does not depend on the order of the table
+static inline bool follower_before(uint32_t count, uint64_t word, uint32_t otherCount, uint64_t otherWord) {
+    return count != otherCount ? count > otherCount : word < otherWord;
+}
 
-            suggestWords(prefixCorpusNode, prefixMainNode, lastWord, suggestions, weights, &suggestionCount, MAX_SUGGESTIONS);
-            sortSuggestions(suggestions, weights, suggestionCount);
+// Function to insert a next word in the ranked list of the best next words of a word
+static void offer_follower(uint64_t *next, uint32_t *counts, int max, uint64_t word, uint32_t count) {
+    int pos = max;
+    while (pos > 0 && (!next[pos - 1] || follower_before(count, word, counts[pos - 1], next[pos - 1]))) pos--;
+    if (pos == max) return;
+    for (int k = max - 1; k > pos; k--) {
+        next[k] = next[k - 1];
+        counts[k] = counts[k - 1];
+    }
+    next[pos] = word;
+    counts[pos] = count;
+}
 
-            printf("Top suggestions for \"%s\":\n", lastWord);
-            for (int i = 0; i < suggestionCount && i < 3; i++) {
-                printf("%s (Weight: %.4f)\n", suggestions[i], weights[i]);
+// Recursive function to write the letters of the words whose hash is wanted, walking a trie while
+// hashing its prefixes. wanted maps a hash to the offset of its word, UINT32_MAX until it is written.
+// In a unified trie only the words of the user are wanted, so the walk skips the rest of the corpus.
+static void write_wanted_words(const Trie *trie, NodeId node, char *prefix, int level, uint64_t hash, const uint64_t *wantedKeys, uint32_t *wantedOffsets, uint32_t wantedMask, char *words, uint32_t *wordBytes) {
+    bool userOnly = trie->unified && !trie->frozen;
+    if ((userOnly ? get_node(trie, node)->checkisUserWord : trie_is_end(trie, node)) && level > 0) {
+        uint64_t key = hash ? hash : 1;
+        for (uint32_t slot = (uint32_t)mix_hashes(key, 0) & wantedMask; wantedKeys[slot]; slot = (slot + 1) & wantedMask) {
+            if (wantedKeys[slot] == key) {
+                if (wantedOffsets[slot] == UINT32_MAX) {
+                    wantedOffsets[slot] = *wordBytes;
+                    memcpy(words + *wordBytes, prefix, level);
+                    words[*wordBytes + level] = '\0';
+                    *wordBytes += level + 1;
+                }
+                break;
             }
-        } else {
-            printf("No suggestions found for \"%s\"\n", lastWord);
         }
-    } else if (choice == 'c') {
-        // Auto-correct functionality
-        char suggestions1[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-        double weights1[MAX_SUGGESTIONS] = {0};
-        int suggestionCount1 = 0;
-
-        char suggestions2[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
-        double weights2[MAX_SUGGESTIONS] = {0};
-        int suggestionCount2 = 0;
-        char lastWord_copy[MAX_WORD_LENGTH];
-        strcpy(lastWord_copy, lastWord);
-        
-        suggest_words_for_correction(mainTrieRoot, root, lastWord, 0.7);
-        
-    } else {
-        printf("Invalid choice. Enter 'f' or 'c'.\n");
     }
+    if (level + 1 >= MAX_WORD_LENGTH) return;
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (trie_next_child(trie, node, &cursor, &label, &child)) {
+        if (userOnly && get_node(trie, child)->subtreeRecency.value <= 0) continue;
+        prefix[level] = label;
+        // FNV-1a extends the hash of the prefix by one letter, as hash_word computes it
+        write_wanted_words(trie, child, prefix, level + 1, (hash ^ label) * 1099511628211ULL, wantedKeys, wantedOffsets, wantedMask, words, wordBytes);
+    }
+}
+
+// Structure of an n-gram of a model being frozen, with its fingerprint and its count
+typedef struct NgramEntry {
+    uint64_t key;
+    uint32_t count;
+} NgramEntry;
+
+// Function to compare n-grams by fingerprint, for qsort
+static int compare_ngram_entries(const void *a, const void *b) {
+    uint64_t x = ((const NgramEntry *)a)->key, y = ((const NgramEntry *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+// Function to compare the next words of two words by the hash of the words, for qsort
+static int compare_follower_choices(const void *a, const void *b) {
+    uint64_t x = ((const FollowerChoice *)a)->word, y = ((const FollowerChoice *)b)->word;
+    return x < y ? -1 : x > y;
+}
 
-    // Free allocated memory
-    free_trie(root);
-    free_trie(mainTrieRoot);
+// Function to get the smallest power of two holding count entries in a table at most two thirds full
+static uint32_t ngram_table_size(uint32_t count) {
+    uint32_t size = 16;
+    while (size / 3 * 2 < count) size *= 2;
+    return size;
+}
 
-    return 0;
-}
\ No newline at end of file
+// Function to freeze the n-gram model of a trie into its compact read-only form: every n-gram keeps
+// only its fingerprint and its quantized count, and every word followed by others keeps the letters
+// of its best NGRAM_FOLLOWERS next words, which are found in the trie. The number of times a word is
+// followed by any word is stored as the bigram of the word and 0.
+void freeze_ngrams(NgramModel *model, const Trie *trie) {
+    if (model->frozen) return;
+    // There are at most as many words followed by others as bigrams
+    uint32_t followerSlots = ngram_table_size(model->bigramCount);
+    FollowerChoice *choices = (FollowerChoice *)calloc(followerSlots, sizeof(FollowerChoice));
+    NgramEntry *entries = (NgramEntry *)malloc(((size_t)model->bigramCount * 2 + model->trigramCount + 1) * sizeof(NgramEntry));
+    if (!entries || !choices) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    uint32_t followerMask = followerSlots - 1;
+
+    uint32_t entry = 0;
+    for (uint32_t i = 0; i < model->bigramSlots + model->trigramSlots; i++) {
+        uint64_t key;
+        uint32_t count;
+        if (i < model->bigramSlots) {
+            if (!model->bigrams[i].first) continue;
+            key = mix_hashes(model->bigrams[i].first, model->bigrams[i].second);
+            count = model->bigrams[i].count;
+            // Ranking the second word among the next words of the first
+            uint64_t first = model->bigrams[i].first;
+            uint32_t slot = (uint32_t)mix_hashes(first, 0) & followerMask;
+            while (choices[slot].word && choices[slot].word != first) slot = (slot + 1) & followerMask;
+            choices[slot].word = first;
+            choices[slot].total += count;
+            offer_follower(choices[slot].next, choices[slot].counts, NGRAM_FOLLOWERS, model->bigrams[i].second, count);
+        } else {
+            uint32_t t = i - model->bigramSlots;
+            if (!model->trigrams[t].key) continue;
+            key = model->trigrams[t].key;
+            count = model->trigrams[t].count;
+        }
+        entries[entry].key = key;
+        entries[entry].count = count;
+        entry++;
+    }
+    uint32_t chosen = 0;
+    for (uint32_t i = 0; i < followerSlots; i++) {
+        if (!choices[i].word) continue;
+        entries[entry].key = mix_hashes(choices[i].word, 0);
+        entries[entry].count = choices[i].total;
+        entry++;
+        choices[chosen++] = choices[i];
+    }
+    uint32_t entryCount = entry;
+    uint32_t slotCount = ngram_table_size(entryCount);
+    uint32_t mask = slotCount - 1;
+    uint64_t *keys = (uint64_t *)calloc(slotCount, sizeof(uint64_t));
+    uint8_t *levels = (uint8_t *)calloc(slotCount, sizeof(uint8_t));
+    if (!keys || !levels) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    // Where an entry lands depends on the entries placed before it, so they are placed in the order of
+    // their fingerprints: the layout then only depends on the counts, not on how the model was built
+    qsort(entries, entryCount, sizeof(NgramEntry), compare_ngram_entries);
+    for (uint32_t i = 0; i < entryCount; i++) {
+        uint32_t slot = (uint32_t)entries[i].key & mask;
+        while (keys[slot]) slot = (slot + 1) & mask;
+        keys[slot] = entries[i].key;
+        levels[slot] = quantize_count(entries[i].count);
+    }
+    free(entries);
+    // The same goes for the next words of every word, gathered at the start of choices
+    qsort(choices, chosen, sizeof(FollowerChoice), compare_follower_choices);
+
+    // Finding the letters of every chosen next word with one walk of the trie
+    uint32_t wantedSlots = ngram_table_size(chosen * NGRAM_FOLLOWERS);
+    uint64_t *wantedKeys = (uint64_t *)calloc(wantedSlots, sizeof(uint64_t));
+    uint32_t *wantedOffsets = (uint32_t *)malloc(wantedSlots * sizeof(uint32_t));
+    if (!wantedKeys || !wantedOffsets) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    uint32_t wantedCount = 0;
+    for (uint32_t i = 0; i < chosen; i++) {
+        for (int k = 0; k < NGRAM_FOLLOWERS && choices[i].next[k]; k++) {
+            uint32_t slot = (uint32_t)mix_hashes(choices[i].next[k], 0) & (wantedSlots - 1);
+            while (wantedKeys[slot] && wantedKeys[slot] != choices[i].next[k]) slot = (slot + 1) & (wantedSlots - 1);
+            if (!wantedKeys[slot]) {
+                wantedKeys[slot] = choices[i].next[k];
+                wantedOffsets[slot] = UINT32_MAX;
+                wantedCount++;
+            }
+        }
+    }
+    char *words = (char *)malloc((size_t)wantedCount * MAX_WORD_LENGTH + 1);
+    if (words == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    uint32_t wordBytes = 0;
+    char prefix[MAX_WORD_LENGTH];
+    write_wanted_words(trie, trie->root, prefix, 0, 1469598103934665603ULL, wantedKeys, wantedOffsets, wantedSlots - 1, words, &wordBytes);
+    char *shrunk = (char *)realloc(words, wordBytes ? wordBytes : 1);
+    if (shrunk) words = shrunk;
+
+    followerSlots = ngram_table_size(chosen);
+    followerMask = followerSlots - 1;
+    NgramFollowers *followers = (NgramFollowers *)calloc(followerSlots, sizeof(NgramFollowers));
+    if (followers == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < chosen; i++) {
+        uint32_t slot = (uint32_t)mix_hashes(choices[i].word, 0) & followerMask;
+        while (followers[slot].word) slot = (slot + 1) & followerMask;
+        NgramFollowers *follower = &followers[slot];
+        follower->word = choices[i].word;
+        int n = 0;
+        for (int k = 0; k < NGRAM_FOLLOWERS && choices[i].next[k]; k++) {
+            uint32_t wanted = (uint32_t)mix_hashes(choices[i].next[k], 0) & (wantedSlots - 1);
+            while (wantedKeys[wanted] != choices[i].next[k]) wanted = (wanted + 1) & (wantedSlots - 1);
+            follower->next[n++] = wantedOffsets[wanted];
+        }
+        for (; n < NGRAM_FOLLOWERS; n++) follower->next[n] = UINT32_MAX;
+    }
+    free(wantedKeys);
+    free(wantedOffsets);
+    free(choices);
+
+    NgramModel frozen;
+    init_ngrams(&frozen);
+    frozen.frozen = true;
+    frozen.slotCount = slotCount;
+    frozen.keys = keys;
+    frozen.levels = levels;
+    frozen.followerSlots = followerSlots;
+    frozen.followers = followers;
+    frozen.words = words;
+    frozen.wordBytes = wordBytes;
+    free_ngrams(model);
+    *model = frozen;
+}
+
+// Function to get the number of bytes used by an n-gram model
+size_t ngram_memory_bytes(const NgramModel *model) {
+    if (model->frozen) {
+        return (size_t)model->slotCount * (sizeof(uint64_t) + sizeof(uint8_t))
+            + (size_t)model->followerSlots * sizeof(NgramFollowers) + model->wordBytes;
+    }
+    return (size_t)model->bigramSlots * sizeof(NgramBigram) + (size_t)model->trigramSlots * sizeof(NgramTrigram);
+}
+
+// Function to get the count of a bigram, approximate once the model is frozen. A second word of 0 stands
+// for every bigram starting with the first word.
+double bigram_count(const NgramModel *model, uint64_t first, uint64_t second) {
+    if (model->frozen) {
+        if (model->slotCount == 0) return 0;
+        uint64_t key = mix_hashes(first, second);
+        uint32_t mask = model->slotCount - 1;
+        for (uint32_t slot = (uint32_t)key & mask; model->keys[slot]; slot = (slot + 1) & mask) {
+            if (model->keys[slot] == key) return dequantize_count(model->levels[slot]);
+        }
+        return 0;
+    }
+    if (SHARED_LOAD(model->bigramCount) == 0) return 0;
+    uint32_t slots;
+    const NgramBigram *bigrams = load_bigrams(model, &slots);
+    if (second == 0) {
+        // The bigrams starting with a word are only totalled when the model is frozen, a model which
+        // is not frozen only holds the words of the user and is scanned
+        double total = 0;
+        for (uint32_t i = 0; i < slots; i++) {
+            if (__atomic_load_n(&bigrams[i].first, __ATOMIC_ACQUIRE) == first) total += SHARED_LOAD(bigrams[i].count);
+        }
+        return total;
+    }
+    // The slot can be filled by another bigram after it was found empty, so its words are checked
+    const NgramBigram *bigram = &bigrams[find_bigram_slot(bigrams, slots, first, second)];
+    bool found = __atomic_load_n(&bigram->first, __ATOMIC_ACQUIRE) == first && bigram->second == second;
+    return found ? SHARED_LOAD(bigram->count) : 0;
+}
+
+// Function to get the count of a trigram, approximate once the model is frozen
+double trigram_count(const NgramModel *model, uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t key = trigram_key(a, b, c);
+    if (model->frozen) {
+        if (model->slotCount == 0) return 0;
+        uint32_t mask = model->slotCount - 1;
+        for (uint32_t slot = (uint32_t)key & mask; model->keys[slot]; slot = (slot + 1) & mask) {
+            if (model->keys[slot] == key) return dequantize_count(model->levels[slot]);
+        }
+        return 0;
+    }
+    if (SHARED_LOAD(model->trigramCount) == 0) return 0;
+    uint32_t slots;
+    const NgramTrigram *trigrams = load_trigrams(model, &slots);
+    const NgramTrigram *trigram = &trigrams[find_trigram_slot(trigrams, slots, key)];
+    return __atomic_load_n(&trigram->key, __ATOMIC_ACQUIRE) == key ? SHARED_LOAD(trigram->count) : 0;
+}
+
+// Function to get the probability of a word after the last one or two words of a context, mixing the
+// trigram and bigram estimates when the trigram context was seen
+double ngram_probability(const NgramModel *model, const uint64_t *context, int contextCount, uint64_t word) {
+    if (contextCount == 0) return 0;
+    uint64_t last = context[contextCount - 1];
+    double total = bigram_count(model, last, 0);
+    double probability = total > 0 ? bigram_count(model, last, word) / total : 0;
+    if (contextCount >= 2) {
+        double pairCount = bigram_count(model, context[contextCount - 2], last);
+        if (pairCount > 0) {
+            double trigram = trigram_count(model, context[contextCount - 2], last, word) / pairCount;
+            probability = NGRAM_TRIGRAM_SHARE * trigram + (1 - NGRAM_TRIGRAM_SHARE) * probability;
+        }
+    }
+    return probability > 1 ? 1 : probability;
+}
+
+// Function to find the best next words of a word in a model, writing their letters to next. The trie
+// of the model gives the letters of the words of a model which is not frozen. Returns how many were found.
+int ngram_next_words(const NgramModel *model, const Trie *trie, uint64_t word, char next[][MAX_WORD_LENGTH], int max) {
+    if (max > NGRAM_FOLLOWERS) max = NGRAM_FOLLOWERS;
+    int count = 0;
+    if (model->frozen) {
+        if (model->followerSlots == 0) return 0;
+        uint32_t mask = model->followerSlots - 1;
+        for (uint32_t slot = (uint32_t)mix_hashes(word, 0) & mask; model->followers[slot].word; slot = (slot + 1) & mask) {
+            if (model->followers[slot].word != word) continue;
+            for (int k = 0; k < max && model->followers[slot].next[k] != UINT32_MAX; k++) {
+                strcpy(next[count++], model->words + model->followers[slot].next[k]);
+            }
+            break;
+        }
+        return count;
+    }
+
+    // A model which is not frozen only holds the words of the user, so its bigrams are scanned
+    uint64_t best[NGRAM_FOLLOWERS] = {0};
+    uint32_t counts[NGRAM_FOLLOWERS] = {0};
+    uint32_t slots;
+    const NgramBigram *bigrams = load_bigrams(model, &slots);
+    for (uint32_t i = 0; i < slots; i++) {
+        if (__atomic_load_n(&bigrams[i].first, __ATOMIC_ACQUIRE) == word && bigrams[i].second) {
+            offer_follower(best, counts, max, bigrams[i].second, SHARED_LOAD(bigrams[i].count));
+        }
+    }
+    uint64_t wantedKeys[NGRAM_WANTED_SLOTS] = {0};
+    uint32_t wantedOffsets[NGRAM_WANTED_SLOTS];
+    uint32_t wantedMask = NGRAM_WANTED_SLOTS - 1;
+    for (int k = 0; k < max && best[k]; k++) {
+        uint32_t slot = (uint32_t)mix_hashes(best[k], 0) & wantedMask;
+        while (wantedKeys[slot]) slot = (slot + 1) & wantedMask;
+        wantedKeys[slot] = best[k];
+        wantedOffsets[slot] = UINT32_MAX;
+    }
+    char words[NGRAM_FOLLOWERS * MAX_WORD_LENGTH];
+    uint32_t wordBytes = 0;
+    char prefix[MAX_WORD_LENGTH];
+    write_wanted_words(trie, trie->root, prefix, 0, 1469598103934665603ULL, wantedKeys, wantedOffsets, wantedMask, words, &wordBytes);
+    for (int k = 0; k < max && best[k]; k++) {
+        uint32_t slot = (uint32_t)mix_hashes(best[k], 0) & wantedMask;
+        while (wantedKeys[slot] != best[k]) slot = (slot + 1) & wantedMask;
+        if (wantedOffsets[slot] != UINT32_MAX) strcpy(next[count++], words + wantedOffsets[slot]);
+    }
+    return count;
+}
+
+// Creation of a new TrieNode inside the pool of the given Trie
+NodeId create_node(Trie *trie) {
+    // Opening a new slab when the node would not fit in the slabs already allocated
+    if ((trie->nodeCount >> NODE_SLAB_SHIFT) >= trie->slabCount) {
+        if (trie->slabCount == trie->slabCapacity) {
+            uint32_t newCapacity = trie->slabCapacity ? trie->slabCapacity * 2 : 8;
+            size_t bytes = newCapacity * sizeof(TrieNode *);
+            // Readers of a concurrent trie can still be using the old table, so it is copied instead of moved
+            TrieNode **slabs = trie->concurrent ? (TrieNode **)malloc(bytes) : (TrieNode **)realloc(trie->slabs, bytes);
+            if (slabs == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+            if (trie->concurrent) {
+                TrieNode **old = trie->slabs;
+                memcpy(slabs, old, trie->slabCount * sizeof(TrieNode *));
+                __atomic_store_n(&trie->slabs, slabs, __ATOMIC_RELEASE);
+                retire_memory(&trie->retired, old);
+            } else {
+                trie->slabs = slabs;
+            }
+            trie->slabCapacity = newCapacity;
+        }
+        trie->slabs[trie->slabCount] = (TrieNode *)malloc(NODE_SLAB_SIZE * sizeof(TrieNode));
+        if (trie->slabs[trie->slabCount] == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        trie->slabCount++;
+    }
+    NodeId id = trie->nodeCount++;
+    STAT_ADD(createNodeCalls, 1);
+    STAT_ADD(liveNodes, 1);
+    TrieNode *new_node = get_node(trie, id);
+    new_node->checkisEndOfWord = false;
+    new_node->checkisUserWord = false;
+    new_node->userTouched = false;
+    new_node->weight = 0;
+    new_node->subtreeMax = 0;
+    new_node->recency.value = 0;
+    new_node->recency.time = 0;
+    new_node->subtreeRecency = new_node->recency;
+    new_node->childLink.word = 0;
+    return id;
+}
+
+// Initializing an empty Trie with its reserved slot and the root node
+void init_trie(Trie *trie) {
+    trie->slabs = NULL;
+    trie->slabCount = 0;
+    trie->slabCapacity = 0;
+    trie->nodeCount = 0;
+    memset(trie->childPools, 0, sizeof(trie->childPools));
+    reset_child_pools(trie);
+    trie->frozen = false;
+    trie->childCount = NULL;
+    trie->firstChild = NULL;
+    trie->labels = NULL;
+    trie->weights = NULL;
+    trie->subtreeMax = NULL;
+    trie->recency = NULL;
+    trie->subtreeRecency = NULL;
+    trie->radix = false;
+    trie->edgeStart = NULL;
+    trie->edgeLength = NULL;
+    trie->edges = NULL;
+    trie->edgeBytes = 0;
+    trie->mapping = NULL;
+    trie->mappingSize = 0;
+    trie->version = 0;
+    trie->maxWeight = 0;
+    trie->hasRecency = false;
+    trie->unified = false;
+    trie->userTouched = NULL;
+    trie->userTouchedCount = 0;
+    trie->userTouchedCapacity = 0;
+    init_ngrams(&trie->ngrams);
+    trie->corpusNgrams = NULL;
+    trie->concurrent = false;
+    memset(&trie->retired, 0, sizeof(trie->retired));
+    trie->prefixCache = NULL;
+    // Slot 0 is reserved as the NULL_NODE sentinel
+    create_node(trie);
+    trie->root = create_node(trie);
+}
+
+// Function to empty a Trie while keeping its slabs, so the words of the next query reuse its memory
+void reset_trie(Trie *trie) {
+    STAT_ADD(liveNodes, -(long long)trie->nodeCount);
+    trie->nodeCount = 0;
+    reset_child_pools(trie);
+    trie->maxWeight = 0;
+    trie->hasRecency = false;
+    clear_ngrams(&trie->ngrams);
+    create_node(trie);
+    trie->root = create_node(trie);
+    trie->version++;
+}
+
+// Forgetting the cached completions a new word changes is defined with the prefix cache
+struct PrefixCache;
+static void prefix_cache_learned(struct PrefixCache *cache, const Trie *trie, const char *word, int length);
+
+// Function to get the node of a word, creating the missing nodes on its path
+static NodeId insert_path(Trie *trie, const char *key, int length) {
+    // Slabs never move, so a node pointer stays valid while new nodes are created
+    NodeId id = trie->root;
+    TrieNode *node = get_node(trie, id);
+    for (int i = 0; i < length; i++) {
+        NodeId child = node_child(trie, node, key[i]);
+        if (!child) {
+            child = create_node(trie);
+            add_child(trie, id, key[i], child);
+        }
+        id = child;
+        node = get_node(trie, id);
+    }
+    return id;
+}
+
+// Function to count one more use of a word, at the given time when it is learned. Everything readers
+// rank the word with is stored before the word is marked as one, and the cached completions it changes
+// are only dropped after that, so neither a reader nor the cache sees it without its recency.
+static void add_word(Trie *trie, const char *key, int length, bool learned, uint32_t time) {
+    TrieNode *node = get_node(trie, insert_path(trie, key, length));
+    Recency recency = node->recency;
+    if (learned) {
+        recency = recency_add(node->recency, time);
+        store_recency(&node->recency, recency);
+        SHARED_STORE(trie->hasRecency, true);
+    }
+    uint32_t weight = node->weight + 1;
+    SHARED_STORE(node->weight, weight);
+    if (weight > trie->maxWeight) {
+        SHARED_STORE(trie->maxWeight, weight);
+    }
+
+    // Raising the subtree maxima of every node on the path of the word
+    TrieNode *pathNode = get_node(trie, trie->root);
+    for (int i = 0; ; i++) {
+        if (pathNode->subtreeMax < weight) {
+            SHARED_STORE(pathNode->subtreeMax, weight);
+        }
+        if (learned && recency_greater(recency, pathNode->subtreeRecency)) {
+            store_recency(&pathNode->subtreeRecency, recency);
+        }
+        if (i == length) break;
+        pathNode = get_node(trie, node_child(trie, pathNode, key[i]));
+    }
+    SHARED_STORE(node->checkisEndOfWord, true);
+    SHARED_STORE(trie->version, trie->version + 1);
+    if (trie->prefixCache) {
+        prefix_cache_learned(trie->prefixCache, trie, key, length);
+    }
+}
+
+// Insertion of a new word of the given length in the Trie
+void insert_word(Trie *trie, const char *key, int length) {
+    add_word(trie, key, length, false, 0);
+}
+
+// Insertion of a new word in the Trie
+void insert(Trie *trie, const char *key) {
+    insert_word(trie, key, strlen(key));
+}
+
+// Insertion of a word typed by the user at the given time, whose weight then decays until it is typed again
+void learn_word(Trie *trie, const char *key, int length, uint32_t time) {
+    add_word(trie, key, length, true, time);
+}
+
+// Function to let threads query a main trie while one thread keeps learning words into it with
+// learn_word, insert_word and ngram_add_word. Readers never take a lock and never wait for the writer:
+// they find every node either before or after a change, and the memory the writer replaces is freed
+// once no reader can be going through it. Queries read it inside begin_trie_read and end_trie_read,
+// which the query functions do by themselves. The trie is not moved, frozen or reset afterwards.
+bool make_trie_concurrent(Trie *trie) {
+    if (trie->frozen || trie->unified || trie->prefixCache) {
+        printf("Only a main trie can be read while words are learned into it\n");
+        return false;
+    }
+    trie->concurrent = true;
+    trie->ngrams.retired = &trie->retired;
+    return true;
+}
+
+// Function to give back the unused end of an array, keeping the array if realloc cannot move it
+static void *shrink_array(void *array, size_t bytes) {
+    void *shrunk = realloc(array, bytes);
+    return shrunk ? shrunk : array;
+}
+
+// Checking whether a node of a trie which is not frozen is merged into the edge of a radix trie: it
+// has a single child and no word ends at it
+static inline bool merged_in_edge(const TrieNode *node) {
+    return !node->checkisEndOfWord && node->childLink.count == 1;
+}
+
+// Function to count the nodes a trie which is not frozen would keep in the radix layout
+static uint32_t radix_node_count(const Trie *trie) {
+    uint32_t count = 2;
+    for (NodeId id = 1; id < trie->nodeCount; id++) {
+        if (id != trie->root && !merged_in_edge(get_node(trie, id))) count++;
+    }
+    return count;
+}
+
+// Function to build the read-only arrays of a trie, in the radix layout when radix is set
+static void freeze_nodes(Trie *trie, bool radix) {
+    // The best next words are written from the trie before its nodes are renumbered
+    freeze_ngrams(&trie->ngrams, trie);
+
+    uint32_t count = trie->nodeCount;
+    uint32_t *childCount = (uint32_t *)malloc(count * sizeof(uint32_t));
+    NodeId *firstChild = (NodeId *)malloc(count * sizeof(NodeId));
+    uint8_t *labels = (uint8_t *)malloc(count);
+    uint32_t *weights = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *subtreeMax = (uint32_t *)malloc(count * sizeof(uint32_t));
+    // The recency counts are only kept for a trie of learned words
+    Recency *recency = NULL, *subtreeRecency = NULL;
+    if (trie->hasRecency) {
+        recency = (Recency *)calloc(count, sizeof(Recency));
+        subtreeRecency = (Recency *)calloc(count, sizeof(Recency));
+        if (!recency || !subtreeRecency) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    // Every node of a radix trie adds the letters of its edge, which are at most one per node merged into it
+    uint32_t *edgeStart = NULL;
+    uint8_t *edgeLength = NULL, *edges = NULL;
+    uint32_t edgeBytes = 0;
+    if (radix) {
+        edgeStart = (uint32_t *)malloc(count * sizeof(uint32_t));
+        edgeLength = (uint8_t *)malloc(count);
+        edges = (uint8_t *)malloc(count);
+        if (!edgeStart || !edgeLength || !edges) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        edgeStart[NULL_NODE] = edgeStart[1] = 0;
+        edgeLength[NULL_NODE] = edgeLength[1] = 0;
+    }
+    // The breadth-first queue holds the old index of every node, in the order of their new indices
+    NodeId *queue = (NodeId *)malloc(count * sizeof(NodeId));
+    if (!childCount || !firstChild || !labels || !weights || !subtreeMax || !queue) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    childCount[NULL_NODE] = 0;
+    firstChild[NULL_NODE] = NULL_NODE;
+    labels[NULL_NODE] = 0;
+    weights[NULL_NODE] = 0;
+    subtreeMax[NULL_NODE] = 0;
+
+    uint32_t head = 1, tail = 1;
+    labels[tail] = 0;
+    queue[tail++] = trie->root;
+    while (head < tail) {
+        NodeId newId = head;
+        NodeId oldId = queue[head++];
+        TrieNode *node = get_node(trie, oldId);
+        firstChild[newId] = tail;
+        int cursor = 0;
+        unsigned char label;
+        NodeId child;
+        while (trie_next_child(trie, oldId, &cursor, &label, &child)) {
+            labels[tail] = label;
+            if (radix) {
+                // The nodes below the child are followed down to the first one which is kept, and
+                // their letters become the edge of that node
+                edgeStart[tail] = edgeBytes;
+                edges[edgeBytes++] = label;
+                while (merged_in_edge(get_node(trie, child))) {
+                    int only = 0;
+                    trie_next_child(trie, child, &only, &label, &child);
+                    edges[edgeBytes++] = label;
+                }
+                edgeLength[tail] = (uint8_t)(edgeBytes - edgeStart[tail]);
+            }
+            queue[tail++] = child;
+        }
+        childCount[newId] = (tail - firstChild[newId]) | (node->checkisEndOfWord ? FROZEN_END_OF_WORD : 0);
+        weights[newId] = node->weight;
+        subtreeMax[newId] = node->subtreeMax;
+        if (recency) {
+            recency[newId] = node->recency;
+            subtreeRecency[newId] = node->subtreeRecency;
+        }
+    }
+    free(queue);
+
+    // The slabs are no longer needed once the frozen arrays are filled
+    uint32_t frozenCount = tail;
+    for (uint32_t i = 0; i < trie->slabCount; i++) {
+        free(trie->slabs[i]);
+    }
+    free(trie->slabs);
+    trie->slabs = NULL;
+    trie->slabCount = 0;
+    trie->slabCapacity = 0;
+    free_child_pools(trie);
+    if (radix && frozenCount < count) {
+        // The arrays were sized for a node per letter, the radix trie only keeps the nodes which branch or end words
+        childCount = (uint32_t *)shrink_array(childCount, frozenCount * sizeof(uint32_t));
+        firstChild = (NodeId *)shrink_array(firstChild, frozenCount * sizeof(NodeId));
+        labels = (uint8_t *)shrink_array(labels, frozenCount);
+        weights = (uint32_t *)shrink_array(weights, frozenCount * sizeof(uint32_t));
+        subtreeMax = (uint32_t *)shrink_array(subtreeMax, frozenCount * sizeof(uint32_t));
+        if (recency) {
+            recency = (Recency *)shrink_array(recency, frozenCount * sizeof(Recency));
+            subtreeRecency = (Recency *)shrink_array(subtreeRecency, frozenCount * sizeof(Recency));
+        }
+        edgeStart = (uint32_t *)shrink_array(edgeStart, frozenCount * sizeof(uint32_t));
+        edgeLength = (uint8_t *)shrink_array(edgeLength, frozenCount);
+    }
+    if (radix) edges = (uint8_t *)shrink_array(edges, edgeBytes ? edgeBytes : 1);
+    STAT_ADD(liveNodes, (long long)frozenCount - trie->nodeCount);
+    trie->nodeCount = frozenCount;
+    trie->root = 1;
+    trie->childCount = childCount;
+    trie->firstChild = firstChild;
+    trie->labels = labels;
+    trie->weights = weights;
+    trie->subtreeMax = subtreeMax;
+    trie->recency = recency;
+    trie->subtreeRecency = subtreeRecency;
+    trie->radix = radix;
+    trie->edgeStart = edgeStart;
+    trie->edgeLength = edgeLength;
+    trie->edges = edges;
+    trie->edgeBytes = edgeBytes;
+    trie->frozen = true;
+    // Every node has a new index, so anything holding the old ones must look them up again
+    trie->version++;
+}
+
+// Function to freeze a Trie that will not change anymore into its compact read-only layout
+void freeze_trie(Trie *trie) {
+    if (trie->frozen) return;
+    freeze_nodes(trie, false);
+}
+
+// Function to freeze a Trie into the read-only radix layout, where the nodes with a single child and
+// no word are merged into the edges of the nodes below them, so a walk only stops where words branch
+// or end. A trie with more nodes than positions can address is frozen with a node per letter instead.
+void freeze_radix_trie(Trie *trie) {
+    if (trie->frozen) return;
+    freeze_nodes(trie, radix_node_count(trie) <= RADIX_NODE_MASK);
+}
+
+// Recursive function to copy the nodes below a node of a trie, frozen or not, into a trie using slabs
+static void copy_nodes(Trie *into, NodeId target, const Trie *from, NodeId source) {
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (trie_next_child(from, source, &cursor, &label, &child)) {
+        NodeId copy = create_node(into);
+        add_child(into, target, label, copy);
+        TrieNode *node = get_node(into, copy);
+        node->checkisEndOfWord = trie_is_end(from, child);
+        node->weight = trie_count(from, child);
+        node->subtreeMax = trie_subtree_count(from, child);
+        node->recency = trie_recency(from, child);
+        node->subtreeRecency = trie_subtree_recency(from, child);
+        copy_nodes(into, copy, from, child);
+    }
+}
+
+// Function to make a Trie which can learn new words from a copy of any trie, such as a frozen snapshot
+void thaw_trie(Trie *trie, const Trie *from) {
+    init_trie(trie);
+    trie->maxWeight = from->maxWeight;
+    trie->hasRecency = from->hasRecency;
+    TrieNode *root = get_node(trie, trie->root);
+    root->checkisEndOfWord = trie_is_end(from, from->root);
+    root->weight = trie_count(from, from->root);
+    root->subtreeMax = trie_subtree_count(from, from->root);
+    root->recency = trie_recency(from, from->root);
+    root->subtreeRecency = trie_subtree_recency(from, from->root);
+    copy_nodes(trie, trie->root, from, from->root);
+}
+
+// Function to build a unified trie holding the words of the corpus trie with their weights. The words
+// of the user are then added to the same nodes with insert_user_word, so a query walks a single trie
+// and finds both weights of a word at its node. The recency counts of its nodes are the ones of the
+// user words. It is only used with --unified: its mutable nodes take about four times the
+// memory of the frozen corpus trie and are slower to walk than the two tries it replaces.
+void build_unified_trie(Trie *unified, const Trie *corpus) {
+    thaw_trie(unified, corpus);
+    unified->unified = true;
+    unified->corpusNgrams = &corpus->ngrams;
+}
+
+// Function to add a node to the list of nodes holding user weights in a unified trie
+static void touch_user_node(Trie *trie, NodeId id) {
+    TrieNode *node = get_node(trie, id);
+    if (node->userTouched) return;
+    if (trie->userTouchedCount == trie->userTouchedCapacity) {
+        uint32_t newCapacity = trie->userTouchedCapacity ? trie->userTouchedCapacity * 2 : 64;
+        NodeId *touched = (NodeId *)realloc(trie->userTouched, newCapacity * sizeof(NodeId));
+        if (touched == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        trie->userTouched = touched;
+        trie->userTouchedCapacity = newCapacity;
+    }
+    trie->userTouched[trie->userTouchedCount++] = id;
+    node->userTouched = true;
+}
+
+// Insertion of a word typed by the user at the given time in a unified trie
+void insert_user_word(Trie *trie, const char *key, int length, uint32_t time) {
+    TrieNode *node = get_node(trie, insert_path(trie, key, length));
+    node->checkisUserWord = true;
+    node->recency = recency_add(node->recency, time);
+    Recency recency = node->recency;
+    trie->version++;
+
+    // Raising the user subtree maximum of every node on the path of the word
+    NodeId id = trie->root;
+    for (int i = 0; ; i++) {
+        node = get_node(trie, id);
+        touch_user_node(trie, id);
+        if (recency_greater(recency, node->subtreeRecency)) {
+            node->subtreeRecency = recency;
+        }
+        if (i == length) break;
+        id = node_child(trie, node, key[i]);
+    }
+}
+
+// Getting the normalized weight of the user word ending at a node of a unified trie
+static inline double unified_user_weight(const Trie *trie, const TrieNode *node) {
+    return normalize_recency(node->recency, get_node(trie, trie->root)->subtreeRecency);
+}
+
+// Function to remove every user word from a unified trie, keeping the corpus words. The nodes created
+// for the user words stay, without any word below them.
+void clear_user_words(Trie *trie) {
+    for (uint32_t i = 0; i < trie->userTouchedCount; i++) {
+        TrieNode *node = get_node(trie, trie->userTouched[i]);
+        node->recency.value = 0;
+        node->recency.time = 0;
+        node->subtreeRecency = node->recency;
+        node->checkisUserWord = false;
+        node->userTouched = false;
+    }
+    trie->userTouchedCount = 0;
+    clear_ngrams(&trie->ngrams);
+    trie->version++;
+}
+
+// Function to combine the weights of a word in the main trie and in the corpus trie
+double combineWeights(double mainWeight, double corpusWeight) {
+    // Taking average of the weights if present in both tries
+    if (mainWeight > 0 && corpusWeight > 0) {
+        return (mainWeight + corpusWeight) / 2.0;  
+    } // If present in the main trie only,then double the weight to show its importance
+    else if (mainWeight > 0) {
+     
+        return mainWeight * 2;
+    } // If present in the corpus trie only, then return the weight of the corpus trie
+    else {
+        return corpusWeight; 
+    }
+}
+
+// Function to start a query reading the main trie, which other threads can be learning words into when
+// it is concurrent. Returns whether the query has to end with end_trie_read.
+static inline bool begin_query(const Trie *main) {
+    if (!main->concurrent) return false;
+    begin_trie_read();
+    return true;
+}
+
+// Function to get the combined weight of a word from two tries
+double getCombinedWeight(Trie *main, NodeId mainNode, Trie *corpus, NodeId corpusNode) {
+    double mainWeight = mainNode ? trie_weight(main, mainNode) : 0;
+    double corpusWeight = corpusNode ? trie_weight(corpus, corpusNode) : 0;
+    return combineWeights(mainWeight, corpusWeight);
+}
+
+// Structure of an entry of the best-first search used by suggestWords. A node entry stands for a
+// pair of nodes reached with the same letters in both tries, and its score is an upper bound of
+// the weights below it. A word entry stands for the word ending at such a pair, with its exact weight.
+typedef struct SearchEntry {
+    NodeId corpusNode;
+    NodeId mainNode;
+    double score;
+    // For a node entry, the node entry it was expanded from; for a word entry, the node entry of its word
+    uint32_t parent;
+    // Number of letters added to the prefix to reach this entry, and the last one of them
+    uint16_t depth;
+    unsigned char letter;
+    bool isWord;
+} SearchEntry;
+
+#define NO_PARENT UINT32_MAX
+
+// Structure of the search state, an arena of entries and a max-heap of their indices
+typedef struct SearchQueue {
+    SearchEntry *entries;
+    uint32_t entryCount;
+    uint32_t entryCapacity;
+    uint32_t *heap;
+    uint32_t heapSize;
+    uint32_t heapCapacity;
+} SearchQueue;
+
+// Function to compare the letters leading to two node entries, in alphabetical order
+static int compare_entry_paths(const SearchEntry *entries, uint32_t a, uint32_t b) {
+    int shorter = 0;
+    while (entries[a].depth > entries[b].depth) {
+        a = entries[a].parent;
+        shorter = 1;
+    }
+    while (entries[b].depth > entries[a].depth) {
+        b = entries[b].parent;
+        shorter = -1;
+    }
+    // One path is a prefix of the other, so the shorter one comes first
+    if (a == b) return shorter;
+    while (entries[a].parent != entries[b].parent) {
+        a = entries[a].parent;
+        b = entries[b].parent;
+    }
+    return entries[a].letter - entries[b].letter;
+}
+
+// Function to check if entry a should be popped before entry b: higher score first, then alphabetical
+static bool entry_before(const SearchEntry *entries, uint32_t a, uint32_t b) {
+    if (entries[a].score != entries[b].score) {
+        return entries[a].score > entries[b].score;
+    }
+    uint32_t nodeA = entries[a].isWord ? entries[a].parent : a;
+    uint32_t nodeB = entries[b].isWord ? entries[b].parent : b;
+    // A word is smaller than every longer word below its own node
+    if (nodeA == nodeB) return entries[a].isWord;
+    return compare_entry_paths(entries, nodeA, nodeB) < 0;
+}
+
+// Function to add an entry to the arena of the search queue without queueing it, returning its index
+static uint32_t append_entry(SearchQueue *queue, SearchEntry entry) {
+    if (queue->entryCount == queue->entryCapacity) {
+        queue->entryCapacity = queue->entryCapacity ? queue->entryCapacity * 2 : 64;
+        queue->entries = (SearchEntry *)realloc(queue->entries, queue->entryCapacity * sizeof(SearchEntry));
+        queue->heapCapacity = queue->entryCapacity;
+        queue->heap = (uint32_t *)realloc(queue->heap, queue->heapCapacity * sizeof(uint32_t));
+        if (!queue->entries || !queue->heap) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    uint32_t index = queue->entryCount++;
+    queue->entries[index] = entry;
+    return index;
+}
+
+// Function to add an entry to the search queue
+static void push_entry(SearchQueue *queue, SearchEntry entry) {
+    uint32_t index = append_entry(queue, entry);
+
+    // Sifting the new entry up the heap
+    uint32_t pos = queue->heapSize++;
+    while (pos > 0) {
+        uint32_t up = (pos - 1) / 2;
+        if (!entry_before(queue->entries, index, queue->heap[up])) break;
+        queue->heap[pos] = queue->heap[up];
+        pos = up;
+    }
+    queue->heap[pos] = index;
+}
+
+// Function to remove the best entry from the search queue and return its index
+static uint32_t pop_entry(SearchQueue *queue) {
+    uint32_t top = queue->heap[0];
+    uint32_t last = queue->heap[--queue->heapSize];
+    uint32_t pos = 0;
+    // Sifting the last entry down from the top of the heap
+    while (2 * pos + 1 < queue->heapSize) {
+        uint32_t child = 2 * pos + 1;
+        if (child + 1 < queue->heapSize && entry_before(queue->entries, queue->heap[child + 1], queue->heap[child])) {
+            child++;
+        }
+        if (!entry_before(queue->entries, queue->heap[child], last)) break;
+        queue->heap[pos] = queue->heap[child];
+        pos = child;
+    }
+    queue->heap[pos] = last;
+    return top;
+}
+
+// Function to get an upper bound of the combined weight of every word below a pair of nodes
+static double subtree_bound(Trie *corpus, NodeId corpusNode, Trie *main, NodeId mainNode) {
+    if (corpus->unified) {
+        // Both weights are found at the node of a unified trie
+        if (!corpusNode) return 0;
+        TrieNode *node = get_node(corpus, corpusNode);
+        double userBound = 2.0 * normalize_recency(node->subtreeRecency, get_node(corpus, corpus->root)->subtreeRecency);
+        double corpusBound = normalize_weight(node->subtreeMax, corpus->maxWeight);
+        return userBound > corpusBound ? userBound : corpusBound;
+    }
+    // A word only in the main trie counts twice, and an average never exceeds the larger weight
+    double mainBound = mainNode ? 2.0 * trie_subtree_max(main, mainNode) : 0;
+    double corpusBound = corpusNode ? trie_subtree_max(corpus, corpusNode) : 0;
+    return mainBound > corpusBound ? mainBound : corpusBound;
+}
+
+// Suggesting the highest weighted words which start with the prefix, for the purpose of auto-fill.
+// The search is best-first over both tries at once: entries are expanded in order of the best weight
+// found below them, so only the nodes on the way to the top suggestions are visited. Words with
+// the same weight are returned in alphabetical order. With a unified corpus trie, the user weights are
+// read from its own nodes and no main node is given. When budget is not NULL, every entry expanded
+// takes one from it, and the search stops when none is left.
+static void suggest_words_within(Trie *corpus, NodeId corpusNode, Trie *main, NodeId mainNode, char *prefix, char suggestions[][MAX_WORD_LENGTH], double weights[], int *suggestionCount, int maxSuggestions, int *budget) {
+    if (*suggestionCount >= maxSuggestions || (!corpusNode && !mainNode)) return;
+
+    SearchQueue queue = {0};
+    SearchEntry start = {corpusNode, mainNode, subtree_bound(corpus, corpusNode, main, mainNode), NO_PARENT, 0, 0, false};
+    push_entry(&queue, start);
+    int prefixLength = strlen(prefix);
+
+    while (queue.heapSize > 0 && *suggestionCount < maxSuggestions && (budget == NULL || *budget > 0)) {
+        if (budget) (*budget)--;
+        uint32_t index = pop_entry(&queue);
+        SearchEntry entry = queue.entries[index];
+        STAT_ADD(fillNodesVisited, 1);
+
+        if (entry.isWord) {
+            // No entry left in the queue can lead to a heavier word, so this one is the next best
+            if (prefixLength + entry.depth < MAX_WORD_LENGTH) {
+                char *word = suggestions[*suggestionCount];
+                strcpy(word, prefix);
+                word[prefixLength + entry.depth] = '\0';
+                for (uint32_t i = entry.parent; queue.entries[i].parent != NO_PARENT; i = queue.entries[i].parent) {
+                    word[prefixLength + queue.entries[i].depth - 1] = queue.entries[i].letter;
+                }
+                weights[*suggestionCount] = entry.score;
+                (*suggestionCount)++;
+            }
+            continue;
+        }
+
+        if (corpus->unified) {
+            TrieNode *node = get_node(corpus, entry.corpusNode);
+            if (node->checkisEndOfWord || node->checkisUserWord) {
+                SearchEntry word = entry;
+                word.score = combineWeights(unified_user_weight(corpus, node), normalize_weight(node->weight, corpus->maxWeight));
+                word.parent = index;
+                word.isWord = true;
+                push_entry(&queue, word);
+            }
+        } else if ((entry.corpusNode && trie_is_end(corpus, entry.corpusNode)) || (entry.mainNode && trie_is_end(main, entry.mainNode))) {
+            SearchEntry word = entry;
+            word.score = getCombinedWeight(main, entry.mainNode, corpus, entry.corpusNode);
+            word.parent = index;
+            word.isWord = true;
+            push_entry(&queue, word);
+        }
+
+        // Now we will push every child pair, scored by the best weight below it. The children of both
+        // nodes come in label order, so they are paired up by merging the two lists.
+        int corpusCursor = 0, mainCursor = 0;
+        unsigned char corpusLabel = 0, mainLabel = 0;
+        NodeId corpusChild = NULL_NODE, mainChild = NULL_NODE;
+        bool hasCorpus = entry.corpusNode && trie_next_child(corpus, entry.corpusNode, &corpusCursor, &corpusLabel, &corpusChild);
+        bool hasMain = entry.mainNode && trie_next_child(main, entry.mainNode, &mainCursor, &mainLabel, &mainChild);
+        while (hasCorpus || hasMain) {
+            bool takeCorpus = hasCorpus && (!hasMain || corpusLabel <= mainLabel);
+            bool takeMain = hasMain && (!hasCorpus || mainLabel <= corpusLabel);
+            NodeId nextCorpusNode = takeCorpus ? corpusChild : NULL_NODE;
+            NodeId nextMainNode = takeMain ? mainChild : NULL_NODE;
+            unsigned char label = takeCorpus ? corpusLabel : mainLabel;
+            SearchEntry child = {nextCorpusNode, nextMainNode, subtree_bound(corpus, nextCorpusNode, main, nextMainNode), index, (uint16_t)(entry.depth + 1), label, false};
+            // Without a main node, the rest of an edge of a radix trie leads to its node alone with the
+            // same bound, so its letters only go in the arena and the node is queued at once
+            const uint8_t *rest = NULL;
+            int restLength = nextMainNode ? 0 : trie_edge_rest(corpus, nextCorpusNode, &rest);
+            for (int k = 0; k < restLength; k++) {
+                child.parent = append_entry(&queue, child);
+                child.depth++;
+                child.letter = rest[k];
+            }
+            if (restLength) child.corpusNode = trie_edge_node(corpus, nextCorpusNode);
+            push_entry(&queue, child);
+            if (takeCorpus) hasCorpus = trie_next_child(corpus, entry.corpusNode, &corpusCursor, &corpusLabel, &corpusChild);
+            if (takeMain) hasMain = trie_next_child(main, entry.mainNode, &mainCursor, &mainLabel, &mainChild);
+        }
+    }
+
+    free(queue.entries);
+    free(queue.heap);
+}
+
+// Function to suggest the best completions of a prefix, with no limit on the entries expanded
+void suggestWords(Trie *corpus, NodeId corpusNode, Trie *main, NodeId mainNode, char *prefix, char suggestions[][MAX_WORD_LENGTH], double weights[], int *suggestionCount, int maxSuggestions) {
+    suggest_words_within(corpus, corpusNode, main, mainNode, prefix, suggestions, weights, suggestionCount, maxSuggestions, NULL);
+}
+
+// Function to find the prefix node of a word in the Trie. In a radix trie, the prefix can end on an
+// edge, and the node found is then the position on that edge.
+NodeId findPrefixNode(Trie *trie, const char *prefix) {
+    NodeId current = trie->root;
+    while (*prefix) {
+        current = trie_child(trie, current, (unsigned char)*prefix);
+        if (!current) {
+            return NULL_NODE;
+        }
+        prefix++;
+        // The rest of an edge is compared with the prefix at once
+        const uint8_t *rest = NULL;
+        int restLength = trie_edge_rest(trie, current, &rest);
+        int matched = 0;
+        while (matched < restLength && prefix[matched] && (unsigned char)prefix[matched] == rest[matched]) {
+            matched++;
+        }
+        if (matched < restLength && prefix[matched]) {
+            return NULL_NODE;
+        }
+        current -= (NodeId)matched << RADIX_NODE_BITS;
+        prefix += matched;
+    }
+    return current;
+}
+
+// Number of best completions cached for a prefix, enough for the suggestions reranked by the n-grams
+#define PREFIX_CACHE_RESULTS (MAX_SUGGESTIONS * NGRAM_RERANK_FACTOR)
+// Longest prefix cached, and the room for the letters of the completions after the prefix. The results
+// of a prefix whose completions do not fit are not cached.
+#define PREFIX_CACHE_PREFIX 16
+#define PREFIX_CACHE_LETTERS 256
+#define PREFIX_CACHE_NONE UINT32_MAX
+
+// Structure of the cached completions of a prefix, in the order suggestWords found them. Only the
+// letters after the prefix are kept, one after the other.
+typedef struct PrefixCacheEntry {
+    uint64_t hash;
+    // Next entry of the same bucket, or of the free entries
+    uint32_t next;
+    uint8_t prefixLength;
+    uint8_t count;
+    // Set when a completion is a word of the main trie, whose weight changes with the highest one
+    bool mainWords;
+    bool used;
+    // Set by every hit, and cleared by the clock hand passing over the entry
+    bool referenced;
+    char prefix[PREFIX_CACHE_PREFIX];
+    double weights[PREFIX_CACHE_RESULTS];
+    uint8_t suffixLengths[PREFIX_CACHE_RESULTS];
+    char suffixes[PREFIX_CACHE_LETTERS];
+} PrefixCacheEntry;
+
+// Structure of a cache of the best completions of the prefixes of auto-fill, for a main trie and the
+// corpus trie it is queried with. Entries are found by the hash of their prefix in chained buckets, and
+// when the cache is full the clock hand evicts the first entry that was not hit since it last passed.
+// A learned word changes the completions of its own prefixes. It can also raise the highest weight of
+// the main trie, which the others are divided by: every main word then weighs less, so only the entries
+// holding main words are stale, while the ones holding corpus words alone still have the best ones.
+// Any other change of the main trie, seen from its version, forgets every entry.
+typedef struct PrefixCache {
+    uint32_t capacity;
+    uint32_t bucketMask;
+    uint32_t *buckets;
+    PrefixCacheEntry *entries;
+    uint32_t freeList;
+    uint32_t hand;
+    // The state of the main trie the entries were computed with
+    uint32_t version;
+    uint32_t maxWeight;
+    Recency maxRecency;
+    bool hasRecency;
+    // Counters of the lookups and of the entries dropped
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long invalidations;
+    unsigned long long flushes;
+} PrefixCache;
+
+// Function to forget every entry of a prefix cache, and take the state of the main trie they now follow
+static void flush_prefix_cache(PrefixCache *cache, const Trie *main) {
+    for (uint32_t i = 0; i <= cache->bucketMask; i++) {
+        cache->buckets[i] = PREFIX_CACHE_NONE;
+    }
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        cache->entries[i].used = false;
+        cache->entries[i].next = i + 1 < cache->capacity ? i + 1 : PREFIX_CACHE_NONE;
+    }
+    cache->freeList = 0;
+    cache->version = main->version;
+    cache->maxWeight = main->maxWeight;
+    cache->maxRecency = trie_subtree_recency(main, main->root);
+    cache->hasRecency = main->hasRecency;
+}
+
+// Function to free a prefix cache
+void free_prefix_cache(PrefixCache *cache) {
+    if (cache == NULL) return;
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache);
+}
+
+// Function to give a main trie a cache of the completions of up to capacity prefixes, used by
+// suggest_completions. The cache is freed with the trie. A trie read by other threads cannot have one.
+bool enable_prefix_cache(Trie *main, uint32_t capacity) {
+    if (main->frozen || main->unified || main->concurrent || capacity == 0) {
+        printf("Only a main trie read by one thread can cache its completions\n");
+        return false;
+    }
+    uint32_t buckets = 1;
+    while (buckets < capacity * 2) buckets *= 2;
+    PrefixCache *cache = (PrefixCache *)calloc(1, sizeof(PrefixCache));
+    if (cache == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    cache->capacity = capacity;
+    cache->bucketMask = buckets - 1;
+    cache->buckets = (uint32_t *)malloc(buckets * sizeof(uint32_t));
+    cache->entries = (PrefixCacheEntry *)malloc(capacity * sizeof(PrefixCacheEntry));
+    if (cache->buckets == NULL || cache->entries == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    flush_prefix_cache(cache, main);
+    free_prefix_cache(main->prefixCache);
+    main->prefixCache = cache;
+    return true;
+}
+
+// Function to get the number of bytes used by a prefix cache
+size_t prefix_cache_memory_bytes(const PrefixCache *cache) {
+    return sizeof(PrefixCache) + (size_t)(cache->bucketMask + 1) * sizeof(uint32_t) + (size_t)cache->capacity * sizeof(PrefixCacheEntry);
+}
+
+// Function to find the entry of a prefix, or PREFIX_CACHE_NONE. The link pointing to the entry is stored
+// in link when it is not NULL, so the entry can be taken out of its bucket.
+static uint32_t find_prefix_entry(PrefixCache *cache, const char *prefix, int length, uint64_t hash, uint32_t **link) {
+    uint32_t *current = &cache->buckets[hash & cache->bucketMask];
+    while (*current != PREFIX_CACHE_NONE) {
+        PrefixCacheEntry *entry = &cache->entries[*current];
+        if (entry->hash == hash && entry->prefixLength == length && memcmp(entry->prefix, prefix, length) == 0) {
+            if (link) *link = current;
+            return *current;
+        }
+        current = &entry->next;
+    }
+    return PREFIX_CACHE_NONE;
+}
+
+// Function to take an entry out of its bucket, found from its prefix
+static void remove_prefix_entry(PrefixCache *cache, uint32_t index) {
+    PrefixCacheEntry *entry = &cache->entries[index];
+    uint32_t *link = NULL;
+    find_prefix_entry(cache, entry->prefix, entry->prefixLength, entry->hash, &link);
+    *link = entry->next;
+    entry->used = false;
+}
+
+// Function to forget an entry, which is then free for the next prefix cached
+static void forget_prefix_entry(PrefixCache *cache, uint32_t index) {
+    remove_prefix_entry(cache, index);
+    cache->entries[index].next = cache->freeList;
+    cache->freeList = index;
+    cache->invalidations++;
+}
+
+// Function to forget the cached completions of every prefix of a word learned in the main trie, which
+// are the only ones it changes as long as the highest weight of the trie does not
+static void prefix_cache_learned(PrefixCache *cache, const Trie *trie, const char *word, int length) {
+    // Any other change since the last word was learned already made every entry stale
+    if (cache->version + 1 != trie->version) {
+        flush_prefix_cache(cache, trie);
+        cache->flushes++;
+        return;
+    }
+    cache->version = trie->version;
+    for (int i = 1; i <= length && i <= PREFIX_CACHE_PREFIX; i++) {
+        uint32_t index = find_prefix_entry(cache, word, i, hash_word(word, i), NULL);
+        if (index != PREFIX_CACHE_NONE) forget_prefix_entry(cache, index);
+    }
+}
+
+// Function to forget the entries the changes of the main trie since they were cached made stale
+static void check_prefix_cache(PrefixCache *cache, const Trie *main) {
+    if (cache->version != main->version || cache->hasRecency != main->hasRecency) {
+        flush_prefix_cache(cache, main);
+        cache->flushes++;
+        return;
+    }
+    // Only learned words changed the trie, so its highest weight can only have grown
+    Recency maxRecency = trie_subtree_recency(main, main->root);
+    bool grown = main->hasRecency ? cache->maxRecency.value != maxRecency.value || cache->maxRecency.time != maxRecency.time
+        : cache->maxWeight != main->maxWeight;
+    if (!grown) return;
+    cache->maxWeight = main->maxWeight;
+    cache->maxRecency = maxRecency;
+    for (uint32_t index = 0; index < cache->capacity; index++) {
+        if (cache->entries[index].used && cache->entries[index].mainWords) forget_prefix_entry(cache, index);
+    }
+}
+
+// Function to get up to max cached completions of a prefix with their weights, as suggestWords would
+// give them. Returns false when the prefix is not cached.
+bool prefix_cache_lookup(PrefixCache *cache, const Trie *main, const char *prefix, char suggestions[][MAX_WORD_LENGTH], double weights[], int *suggestionCount, int max) {
+    int length = strlen(prefix);
+    if (length > PREFIX_CACHE_PREFIX || max > PREFIX_CACHE_RESULTS) return false;
+    check_prefix_cache(cache, main);
+    uint32_t index = find_prefix_entry(cache, prefix, length, hash_word(prefix, length), NULL);
+    if (index == PREFIX_CACHE_NONE) {
+        cache->misses++;
+        return false;
+    }
+    PrefixCacheEntry *entry = &cache->entries[index];
+    entry->referenced = true;
+    int count = entry->count < max ? entry->count : max;
+    const char *suffix = entry->suffixes;
+    for (int i = 0; i < count; i++) {
+        memcpy(suggestions[i], prefix, length);
+        memcpy(suggestions[i] + length, suffix, entry->suffixLengths[i]);
+        suggestions[i][length + entry->suffixLengths[i]] = '\0';
+        weights[i] = entry->weights[i];
+        suffix += entry->suffixLengths[i];
+    }
+    *suggestionCount = count;
+    cache->hits++;
+    return true;
+}
+
+// Function to cache the completions of a prefix found by suggestWords with PREFIX_CACHE_RESULTS wanted,
+// evicting an entry when the cache is full
+void prefix_cache_store(PrefixCache *cache, Trie *main, const char *prefix, char suggestions[][MAX_WORD_LENGTH], const double weights[], int suggestionCount) {
+    int length = strlen(prefix);
+    if (length == 0 || length > PREFIX_CACHE_PREFIX) return;
+    int letters = 0;
+    for (int i = 0; i < suggestionCount; i++) {
+        letters += strlen(suggestions[i]) - length;
+    }
+    if (letters > PREFIX_CACHE_LETTERS) return;
+    check_prefix_cache(cache, main);
+    uint64_t hash = hash_word(prefix, length);
+    if (find_prefix_entry(cache, prefix, length, hash, NULL) != PREFIX_CACHE_NONE) return;
+
+    uint32_t index = cache->freeList;
+    if (index != PREFIX_CACHE_NONE) {
+        cache->freeList = cache->entries[index].next;
+    } else {
+        // Every entry is used, the clock hand gives the ones hit since it last passed a second chance
+        while (cache->entries[cache->hand].referenced) {
+            cache->entries[cache->hand].referenced = false;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        index = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        remove_prefix_entry(cache, index);
+        cache->evictions++;
+    }
+    PrefixCacheEntry *entry = &cache->entries[index];
+    entry->hash = hash;
+    entry->prefixLength = (uint8_t)length;
+    memcpy(entry->prefix, prefix, length);
+    entry->count = (uint8_t)suggestionCount;
+    entry->used = true;
+    entry->referenced = false;
+    entry->mainWords = false;
+    char *suffix = entry->suffixes;
+    for (int i = 0; i < suggestionCount; i++) {
+        int suffixLength = strlen(suggestions[i]) - length;
+        memcpy(suffix, suggestions[i] + length, suffixLength);
+        entry->suffixLengths[i] = (uint8_t)suffixLength;
+        entry->weights[i] = weights[i];
+        suffix += suffixLength;
+        NodeId mainNode = findPrefixNode(main, suggestions[i]);
+        if (mainNode && trie_is_end(main, mainNode)) entry->mainWords = true;
+    }
+    uint32_t *bucket = &cache->buckets[hash & cache->bucketMask];
+    entry->next = *bucket;
+    *bucket = index;
+}
+
+// Structure of one level of an auto-fill session: the nodes reached by the first letters of the
+// prefix in both tries, and the best suggestions below them once they have been asked for
+typedef struct SessionLevel {
+    NodeId corpusNode;
+    NodeId mainNode;
+    bool cached;
+    int count;
+    char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    double weights[MAX_SUGGESTIONS];
+} SessionLevel;
+
+// Structure of an auto-fill session following a word as it is typed, one keystroke at a time.
+// levels[d] belongs to the first d letters of the prefix, so a backspace only steps back a level
+// and finds its nodes and suggestions as they were.
+typedef struct AutofillSession {
+    Trie *corpus;
+    Trie *main;
+    char prefix[MAX_WORD_LENGTH];
+    int depth;
+    // Versions of the tries the levels were computed with
+    uint32_t corpusVersion;
+    uint32_t mainVersion;
+    SessionLevel levels[MAX_WORD_LENGTH];
+} AutofillSession;
+
+// Function to start a session with an empty prefix
+void session_start(AutofillSession *session, Trie *corpus, Trie *main) {
+    session->corpus = corpus;
+    session->main = main;
+    session->prefix[0] = '\0';
+    session->depth = 0;
+    session->corpusVersion = corpus->version;
+    session->mainVersion = SHARED_LOAD(main->version);
+    session->levels[0].corpusNode = corpus->root;
+    session->levels[0].mainNode = main->root;
+    session->levels[0].cached = false;
+}
+
+// Function to find the nodes of the next level from the nodes of the current one
+static void session_step(AutofillSession *session, int depth, unsigned char label) {
+    SessionLevel *from = &session->levels[depth];
+    SessionLevel *to = &session->levels[depth + 1];
+    to->corpusNode = from->corpusNode ? trie_child(session->corpus, from->corpusNode, label) : NULL_NODE;
+    to->mainNode = from->mainNode ? trie_child(session->main, from->mainNode, label) : NULL_NODE;
+    to->cached = false;
+}
+
+// Function to type one more letter, or one byte of a UTF-8 encoded letter, returning false if it cannot
+// be added to the prefix
+bool session_push_char(AutofillSession *session, char letter) {
+    if (!is_word_byte((unsigned char)letter) || session->depth + 1 >= MAX_WORD_LENGTH) return false;
+    letter = lower_word_byte((unsigned char)letter);
+    bool reading = begin_query(session->main);
+    session_step(session, session->depth, (unsigned char)letter);
+    if (reading) end_trie_read();
+    session->prefix[session->depth++] = letter;
+    session->prefix[session->depth] = '\0';
+    return true;
+}
+
+// Function to erase the last letter typed, returning false if the prefix is already empty
+bool session_pop_char(AutofillSession *session) {
+    if (session->depth == 0) return false;
+    session->prefix[--session->depth] = '\0';
+    return true;
+}
+
+// Function to find the nodes of every level again after one of the tries has changed, as words
+// learned since may have created nodes for the prefix and changed the best suggestions
+static void session_refresh(AutofillSession *session) {
+    uint32_t mainVersion = SHARED_LOAD(session->main->version);
+    if (session->corpusVersion == session->corpus->version && session->mainVersion == mainVersion) return;
+    session->corpusVersion = session->corpus->version;
+    session->mainVersion = mainVersion;
+    session->levels[0].cached = false;
+    for (int d = 0; d < session->depth; d++) {
+        session_step(session, d, (unsigned char)session->prefix[d]);
+    }
+}
+
+// Function to get the best suggestions for the prefix typed so far, returning how many there are.
+// They are computed once per level, and a new letter first tries to reuse those of the level above.
+int session_suggestions(AutofillSession *session, char suggestions[][MAX_WORD_LENGTH], double weights[]) {
+    bool reading = begin_query(session->main);
+    session_refresh(session);
+    int depth = session->depth;
+    SessionLevel *level = &session->levels[depth];
+
+    if (!level->cached) {
+        level->count = 0;
+        if (depth > 0 && session->levels[depth - 1].cached) {
+            // The best words of the level above which go on with this letter are also the best
+            // words of this level, in the same order
+            SessionLevel *parent = &session->levels[depth - 1];
+            for (int i = 0; i < parent->count; i++) {
+                if (strncmp(parent->suggestions[i], session->prefix, depth) == 0) {
+                    strcpy(level->suggestions[level->count], parent->suggestions[i]);
+                    level->weights[level->count] = parent->weights[i];
+                    level->count++;
+                }
+            }
+            // They are complete if they fill the list, or if the level above had fewer words than asked for
+            if (level->count < MAX_SUGGESTIONS && parent->count == MAX_SUGGESTIONS) {
+                level->count = 0;
+            }
+        }
+        if (level->count == 0 && (level->corpusNode || level->mainNode)) {
+            suggestWords(session->corpus, level->corpusNode, session->main, level->mainNode, session->prefix,
+                level->suggestions, level->weights, &level->count, MAX_SUGGESTIONS);
+        }
+        level->cached = true;
+    }
+    if (reading) end_trie_read();
+
+    for (int i = 0; i < level->count; i++) {
+        strcpy(suggestions[i], level->suggestions[i]);
+        weights[i] = level->weights[i];
+    }
+    return level->count;
+}
+
+// Number of words scored together by levenshtein_batch, one per 64-bit lane of a vector register
+#ifdef __AVX2__
+#define LEVENSHTEIN_LANES 4
+#else
+#define LEVENSHTEIN_LANES 2
+#endif
+
+// Longest word the bit-parallel kernel can hold in one machine word
+#define BIT_PARALLEL_MAX 64
+
+// Function to build the match masks of a pattern: bit i of peq[c] is set when pattern[i] == c
+static void build_match_masks(const char *pattern, int length, uint64_t peq[256]) {
+    memset(peq, 0, 256 * sizeof(uint64_t));
+    for (int i = 0; i < length; i++) {
+        peq[(unsigned char)pattern[i]] |= 1ULL << i;
+    }
+}
+
+// Function to calculate the Levenshtein distance with the bit-parallel algorithm of Myers, as
+// formulated by Hyyro for the distance between whole strings. The pattern (at most 64 letters)
+// is held as one bit per letter, so each letter of the text updates a whole column of the table
+// with a few word operations. The search stops early once the distance must exceed the limit.
+static int myers_distance(const char *pattern, int m, const char *text, int n, int limit) {
+    if (m == 0) return n;
+    uint64_t peq[256];
+    build_match_masks(pattern, m, peq);
+
+    uint64_t pv = m == 64 ? ~0ULL : (1ULL << m) - 1;
+    uint64_t mv = 0;
+    uint64_t high = 1ULL << (m - 1);
+    int score = m;
+    for (int j = 0; j < n; j++) {
+        uint64_t eq = peq[(unsigned char)text[j]];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if (ph & high) score++;
+        else if (mh & high) score--;
+        STAT_ADD(levenshteinCells, m);
+        // Each remaining letter of the text lowers the distance by at most one
+        if (score - (n - j - 1) > limit) return limit + 1;
+        // The first row of the table grows by one per letter of the text
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+// Function to calculate the Levenshtein distance with two rows of the dynamic programming table,
+// used when both words are too long for the bit-parallel kernel
+static int row_distance(const char *s1, int len1, const char *s2, int len2, int limit) {
+    int *previous = (int *)malloc((len2 + 1) * 2 * sizeof(int));
+    if (previous == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    int *current = previous + len2 + 1;
+    for (int j = 0; j <= len2; j++) previous[j] = j;
+
+    for (int i = 1; i <= len1; i++) {
+        current[0] = i;
+        int row_min = i;
+        STAT_ADD(levenshteinCells, len2);
+        for (int j = 1; j <= len2; j++) {
+            int cost = (s1[i - 1] == s2[j - 1]) ? 0 : 1;
+            int best = previous[j - 1] + cost;
+            if (previous[j] + 1 < best) best = previous[j] + 1;
+            if (current[j - 1] + 1 < best) best = current[j - 1] + 1;
+            current[j] = best;
+            if (best < row_min) row_min = best;
+        }
+        if (row_min > limit) {
+            free(previous < current ? previous : current);
+            return limit + 1;
+        }
+        int *swap = previous;
+        previous = current;
+        current = swap;
+    }
+    int distance = previous[len2];
+    free(previous < current ? previous : current);
+    return distance;
+}
+
+// Function to calculate the Levenshtein distance between two words, or limit + 1 if it is larger than limit
+int levenshtein_within(const char *s1, int len1, const char *s2, int len2, int limit) {
+    STAT_ADD(levenshteinCalls, 1);
+    int difference = len1 > len2 ? len1 - len2 : len2 - len1;
+    if (difference > limit) return limit + 1;
+    // The shorter word is used as the pattern of the bit-parallel kernel
+    if (len1 <= len2 && len1 <= BIT_PARALLEL_MAX) return myers_distance(s1, len1, s2, len2, limit);
+    if (len2 <= BIT_PARALLEL_MAX) return myers_distance(s2, len2, s1, len1, limit);
+    return row_distance(s1, len1, s2, len2, limit);
+}
+
+// Function to calculate the Levenshtein distance between two strings
+int levenshtein_distance(const char *s1, const char *s2) {
+    int len1 = strlen(s1);
+    int len2 = strlen(s2);
+    return levenshtein_within(s1, len1, s2, len2, len1 > len2 ? len1 : len2);
+}
+
+typedef uint64_t LaneMask __attribute__((vector_size(LEVENSHTEIN_LANES * sizeof(uint64_t))));
+typedef int64_t LaneScore __attribute__((vector_size(LEVENSHTEIN_LANES * sizeof(int64_t))));
+
+// Function to calculate the Levenshtein distances between one input and many words, or limit + 1 for the
+// words further than limit. The bit-parallel kernel runs on LEVENSHTEIN_LANES words at once, each in a
+// 64-bit lane of an SSE2 or AVX2 register, since they all share the match masks of the input.
+void levenshtein_batch(const char *input, int input_length, const char *const *words, int count, int limit, int *distances) {
+    if (input_length == 0 || input_length > BIT_PARALLEL_MAX) {
+        for (int w = 0; w < count; w++) {
+            distances[w] = levenshtein_within(input, input_length, words[w], strlen(words[w]), limit);
+        }
+        return;
+    }
+    uint64_t peq[256];
+    build_match_masks(input, input_length, peq);
+    // Letter 0 never matches, it stands in for the letters past the end of the shorter words
+    peq[0] = 0;
+    uint64_t all = input_length == 64 ? ~0ULL : (1ULL << input_length) - 1;
+
+    for (int base = 0; base < count; base += LEVENSHTEIN_LANES) {
+        int lanes = count - base < LEVENSHTEIN_LANES ? count - base : LEVENSHTEIN_LANES;
+        STAT_ADD(levenshteinCalls, lanes);
+        const unsigned char *text[LEVENSHTEIN_LANES];
+        int64_t lengths[LEVENSHTEIN_LANES];
+        int longest = 0;
+        for (int l = 0; l < LEVENSHTEIN_LANES; l++) {
+            // Unused lanes repeat the first word of the batch and are ignored at the end
+            text[l] = (const unsigned char *)words[base + (l < lanes ? l : 0)];
+            lengths[l] = strlen((const char *)text[l]);
+            if (lengths[l] > longest) longest = lengths[l];
+        }
+
+        LaneMask pv, mv, high, one;
+        LaneScore score, length;
+        for (int l = 0; l < LEVENSHTEIN_LANES; l++) {
+            pv[l] = all;
+            mv[l] = 0;
+            high[l] = 1ULL << (input_length - 1);
+            one[l] = 1;
+            score[l] = input_length;
+            length[l] = lengths[l];
+        }
+
+        for (int j = 0; j < longest; j++) {
+            LaneMask eq;
+            for (int l = 0; l < LEVENSHTEIN_LANES; l++) {
+                eq[l] = j < lengths[l] ? peq[text[l][j]] : 0;
+            }
+            STAT_ADD(levenshteinCells, (unsigned long long)input_length * lanes);
+            LaneMask xv = eq | mv;
+            LaneMask xh = (((eq & pv) + pv) ^ pv) | eq;
+            LaneMask ph = mv | ~(xh | pv);
+            LaneMask mh = pv & xh;
+            // Lanes whose word has ended keep their final score
+            LaneScore active = (LaneScore)(j < length);
+            LaneScore up = (LaneScore)((ph & high) != 0);
+            LaneScore down = (LaneScore)((mh & high) != 0);
+            score += (down - up) & active;
+            ph = (ph << 1) | one;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+
+            // Stopping once every lane is certain to exceed the limit
+            LaneScore remaining = length - (j + 1);
+            remaining &= (LaneScore)(remaining > 0);
+            LaneScore beyond = (LaneScore)(score - remaining > limit);
+            bool allBeyond = true;
+            for (int l = 0; l < lanes; l++) {
+                if (!beyond[l]) allBeyond = false;
+            }
+            if (allBeyond) break;
+        }
+        for (int l = 0; l < lanes; l++) {
+            distances[base + l] = score[l] > limit ? limit + 1 : (int)score[l];
+        }
+    }
+}
+
+// Function to grow a buffer so it can hold at least the needed number of items
+static void *grow_buffer(void *buffer, uint32_t *capacity, size_t needed, size_t itemSize) {
+    if (needed <= *capacity) return buffer;
+    uint32_t newCapacity = *capacity ? *capacity : 64;
+    while (newCapacity < needed) newCapacity *= 2;
+    buffer = realloc(buffer, (size_t)newCapacity * itemSize);
+    if (buffer == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return buffer;
+}
+
+// Structure of a word found while collecting corrections, with its score so far. The letters of the
+// word are stored once in the letters of its CorrectionSet, at the given offset.
+typedef struct CorrectionCandidate {
+    // The hash of the word, 0 for an empty slot
+    uint64_t hash;
+    uint32_t word;
+    // A flag to check if the scores of both tries were combined
+    bool combined;
+    double score;
+} CorrectionCandidate;
+
+// Structure of the words found while collecting the corrections of a word. They are kept in an
+// open-addressing table keyed by the hash of the word, so a word found in both tries is merged
+// without scanning the others, and there is no limit on how many are found.
+typedef struct CorrectionSet {
+    CorrectionCandidate *slots;
+    uint32_t slotCount;
+    uint32_t count;
+    char *letters;
+    uint32_t letterBytes;
+    uint32_t letterCapacity;
+    // Slots of the best candidates while they are selected
+    uint32_t *heap;
+    uint32_t heapCapacity;
+} CorrectionSet;
+
+// Function to free the memory of a set of corrections
+void free_correction_set(CorrectionSet *set) {
+    free(set->slots);
+    free(set->letters);
+    free(set->heap);
+    memset(set, 0, sizeof(*set));
+}
+
+// Function to empty a set of corrections before the next word, keeping its memory
+void clear_correction_set(CorrectionSet *set) {
+    if (set->count) memset(set->slots, 0, set->slotCount * sizeof(CorrectionCandidate));
+    set->count = 0;
+    set->letterBytes = 0;
+}
+
+// Function to get the slot of a word in a set of corrections, which is either the slot holding it or
+// the empty slot where it belongs
+static uint32_t find_correction_slot(const CorrectionSet *set, const char *word, uint64_t hash) {
+    uint32_t mask = set->slotCount - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (set->slots[slot].hash && (set->slots[slot].hash != hash || strcmp(set->letters + set->slots[slot].word, word) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Function to double the table of a set of corrections, keeping it at most half full
+static void grow_correction_set(CorrectionSet *set) {
+    CorrectionSet old = *set;
+    set->slotCount = old.slotCount ? old.slotCount * 2 : 64;
+    set->slots = (CorrectionCandidate *)calloc(set->slotCount, sizeof(CorrectionCandidate));
+    if (set->slots == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < old.slotCount; i++) {
+        if (!old.slots[i].hash) continue;
+        uint32_t slot = (uint32_t)old.slots[i].hash & (set->slotCount - 1);
+        while (set->slots[slot].hash) slot = (slot + 1) & (set->slotCount - 1);
+        set->slots[slot] = old.slots[i];
+    }
+    free(old.slots);
+}
+
+// Function to add a word with its score to a set of corrections. The same word found again, in the
+// other trie, gets the average of its two scores.
+static void add_correction_candidate(CorrectionSet *set, const char *word, double score, bool combined) {
+    if ((set->count + 1) * 2 > set->slotCount) grow_correction_set(set);
+    int length = strlen(word);
+    uint64_t hash = hash_word(word, length);
+    uint32_t slot = find_correction_slot(set, word, hash);
+    CorrectionCandidate *candidate = &set->slots[slot];
+    if (candidate->hash) {
+        if (!candidate->combined) {
+            candidate->score = (candidate->score + score) / 2;
+            candidate->combined = true;
+        }
+        return;
+    }
+    set->letters = (char *)grow_buffer(set->letters, &set->letterCapacity, (size_t)set->letterBytes + length + 1, 1);
+    memcpy(set->letters + set->letterBytes, word, length + 1);
+    candidate->hash = hash;
+    candidate->word = set->letterBytes;
+    candidate->combined = combined;
+    candidate->score = score;
+    set->letterBytes += length + 1;
+    set->count++;
+}
+
+// Function to check if a candidate ranks below another: lower score first, then later in alphabetical order
+static bool correction_below(const CorrectionSet *set, uint32_t a, uint32_t b) {
+    const CorrectionCandidate *x = &set->slots[a], *y = &set->slots[b];
+    if (x->score != y->score) return x->score < y->score;
+    return strcmp(set->letters + x->word, set->letters + y->word) > 0;
+}
+
+// Function to move the candidate at pos of the heap down to its place. The heap has the lowest
+// ranked of the best candidates at its top, so a better candidate replaces it.
+static void sift_correction_down(CorrectionSet *set, uint32_t pos, uint32_t size) {
+    uint32_t *heap = set->heap;
+    uint32_t moving = heap[pos];
+    while (2 * pos + 1 < size) {
+        uint32_t child = 2 * pos + 1;
+        if (child + 1 < size && correction_below(set, heap[child + 1], heap[child])) child++;
+        if (!correction_below(set, heap[child], moving)) break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = moving;
+}
+
+// Function to write the best candidates of a set of corrections to best, sorted by score, returning how
+// many were written. A min-heap of the best max candidates seen so far keeps the selection O(n log max).
+int best_corrections(CorrectionSet *set, Suggestion *best, int max) {
+    if (max <= 0 || set->count == 0) return 0;
+    uint32_t size = 0;
+    set->heap = (uint32_t *)grow_buffer(set->heap, &set->heapCapacity, max, sizeof(uint32_t));
+    for (uint32_t slot = 0; slot < set->slotCount; slot++) {
+        if (!set->slots[slot].hash) continue;
+        if (size < (uint32_t)max) {
+            // Moving the new candidate up to its place
+            uint32_t pos = size++;
+            while (pos > 0 && correction_below(set, slot, set->heap[(pos - 1) / 2])) {
+                set->heap[pos] = set->heap[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            set->heap[pos] = slot;
+        } else if (correction_below(set, set->heap[0], slot)) {
+            set->heap[0] = slot;
+            sift_correction_down(set, 0, size);
+        }
+    }
+    // Taking the lowest ranked candidate off the heap fills the list from its end
+    int count = size;
+    for (int i = count - 1; i >= 0; i--) {
+        const CorrectionCandidate *candidate = &set->slots[set->heap[0]];
+        strcpy(best[i].word, set->letters + candidate->word);
+        best[i].score = candidate->score;
+        best[i].combined = candidate->combined;
+        set->heap[0] = set->heap[--size];
+        sift_correction_down(set, 0, size);
+    }
+    return count;
+}
+
+// Function to record a word within the distance limit, combining it with the same word from the other trie
+static void add_correction(CorrectionSet *set, const char *word, int lev_dist, double weight, double alpha, double max_weight) {
+    double normalized_weight = weight / max_weight;
+    double score = alpha * (1.0 / (lev_dist + 1)) + (1 - alpha) * normalized_weight;
+    add_correction_candidate(set, word, score, false);
+}
+
+// Function to record a word of a unified trie within the distance limit. A word of both the user and the
+// corpus gets the average of its two scores, as add_correction gives it across two tries.
+static void add_unified_correction(const Trie *trie, NodeId id, CorrectionSet *set, const char *word, int lev_dist, double alpha, double max_weight) {
+    const TrieNode *node = get_node(trie, id);
+    if (!node->checkisEndOfWord && !node->checkisUserWord) return;
+    double similarity = alpha * (1.0 / (lev_dist + 1));
+    double userScore = similarity + (1 - alpha) * (unified_user_weight(trie, node) / max_weight);
+    double corpusScore = similarity + (1 - alpha) * (normalize_weight(node->weight, trie->maxWeight) / max_weight);
+    bool combined = node->checkisUserWord && node->checkisEndOfWord;
+    if (combined) {
+        add_correction_candidate(set, word, (userScore + corpusScore) / 2, true);
+    } else {
+        add_correction_candidate(set, word, node->checkisUserWord ? userScore : corpusScore, false);
+    }
+}
+
+// Function to compute the next row of the edit distance table between the input and a prefix from
+// the row of the prefix without its last letter, returning the smallest cell of the new row
+static inline int next_distance_row(const int *previous, int *current, const char *input, int input_length, char letter) {
+    STAT_ADD(correctNodesVisited, 1);
+    STAT_ADD(levenshteinCells, input_length);
+    current[0] = previous[0] + 1;
+    int row_min = current[0];
+    for (int j = 1; j <= input_length; j++) {
+        int cost = (input[j - 1] == letter) ? 0 : 1;
+        int best = previous[j - 1] + cost;
+        if (previous[j] + 1 < best) best = previous[j] + 1;
+        if (current[j - 1] + 1 < best) best = current[j - 1] + 1;
+        current[j] = best;
+        if (best < row_min) row_min = best;
+    }
+    return row_min;
+}
+
+// Recursive function to collect the words within LEVENSHTEIN_LIMIT of the input for the purpose of auto-correct.
+// rows[level] is the last row of the edit distance table between the input and the current prefix, so
+// every child only computes one new row from its parent's, and the rows of a shared prefix are computed
+// once for all the words below it. A branch is dropped as soon as no cell of its row is within the limit,
+// because the distance can only grow from there on.
+void collect_suggestions(Trie *trie, NodeId node, char *prefix, int level, int rows[][MAX_WORD_LENGTH + 1], CorrectionSet *set, const char *input, int input_length, double alpha, double max_weight) {
+    if (level + 1 >= MAX_WORD_LENGTH) return;
+
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (trie_next_child(trie, node, &cursor, &label, &child)) {
+        if (next_distance_row(rows[level], rows[level + 1], input, input_length, (char)label) > LEVENSHTEIN_LIMIT) continue;
+        prefix[level] = (char)label;
+        // In a radix trie, the rows of the rest of the edge to the child follow in a loop, as no word
+        // ends and no branch starts before its node. The edge is only read once its first letter is kept.
+        const uint8_t *rest = NULL;
+        int restLength = trie_edge_rest(trie, child, &rest);
+        int depth = level + 1;
+        bool pruned = depth + restLength >= MAX_WORD_LENGTH;
+        for (int k = 0; k < restLength && !pruned; k++, depth++) {
+            pruned = next_distance_row(rows[depth], rows[depth + 1], input, input_length, (char)rest[k]) > LEVENSHTEIN_LIMIT;
+            prefix[depth] = (char)rest[k];
+        }
+        if (pruned) {
+            prefix[level] = '\0';
+            continue;
+        }
+        child = trie_edge_node(trie, child);
+        int distance = rows[depth][input_length];
+
+        prefix[depth] = '\0';
+        if (trie->unified) {
+            if (distance <= LEVENSHTEIN_LIMIT) {
+                add_unified_correction(trie, child, set, prefix, distance, alpha, max_weight);
+            }
+        } else if (trie_is_end(trie, child) && distance <= LEVENSHTEIN_LIMIT) {
+            add_correction(set, prefix, distance, trie_weight(trie, child), alpha, max_weight);
+        }
+        collect_suggestions(trie, child, prefix, depth, rows, set, input, input_length, alpha, max_weight);
+        prefix[level] = '\0';
+    }
+}
+
+// Function to hash a word or a deletion variant of it
+static uint64_t hash_word(const char *word, int length) {
+    // FNV-1a, with 0 kept free for the empty slots of the SymSpell table
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+typedef void (*DeleteVisitor)(uint64_t hash, void *context);
+
+// Recursive function to visit the hash of a word and of every variant with up to LEVENSHTEIN_LIMIT letters deleted.
+// Deletions are made at increasing positions so most variants are only produced once.
+static void visit_deletes(const char *word, int length, int start, int depth, DeleteVisitor visit, void *context) {
+    visit(hash_word(word, length), context);
+    if (depth == LEVENSHTEIN_LIMIT) return;
+
+    char variant[MAX_WORD_LENGTH];
+    for (int i = start; i < length; i++) {
+        memcpy(variant, word, i);
+        memcpy(variant + i, word + i + 1, length - i - 1);
+        visit_deletes(variant, length - 1, i, depth + 1, visit, context);
+    }
+}
+
+// Structure of a (variant hash, word id) pair produced while building the index
+typedef struct DeletePair {
+    uint64_t hash;
+    uint32_t word;
+} DeletePair;
+
+// Structure of the growing arrays used while building the index
+typedef struct SymSpellBuilder {
+    SymSpellIndex *index;
+    uint32_t wordCapacity;
+    uint32_t stringCapacity;
+    DeletePair *pairs;
+    size_t pairCount;
+    size_t pairCapacity;
+    uint32_t currentWord;
+} SymSpellBuilder;
+
+// Recursive function to give an id to every word of the trie, in alphabetical order
+static void collect_index_words(SymSpellBuilder *builder, Trie *trie, NodeId node, char *prefix, int level) {
+    SymSpellIndex *index = builder->index;
+    if (trie_is_end(trie, node)) {
+        // Both word arrays grow together, so they share one capacity
+        uint32_t capacity = builder->wordCapacity;
+        index->wordOffsets = (uint32_t *)grow_buffer(index->wordOffsets, &capacity, index->wordCount + 1, sizeof(uint32_t));
+        index->wordWeights = (float *)grow_buffer(index->wordWeights, &builder->wordCapacity, index->wordCount + 1, sizeof(float));
+        index->strings = (char *)grow_buffer(index->strings, &builder->stringCapacity, index->stringBytes + level + 1, 1);
+        index->wordOffsets[index->wordCount] = index->stringBytes;
+        index->wordWeights[index->wordCount] = trie_weight(trie, node);
+        memcpy(index->strings + index->stringBytes, prefix, level);
+        index->strings[index->stringBytes + level] = '\0';
+        index->stringBytes += level + 1;
+        index->wordCount++;
+    }
+    if (level + 1 >= MAX_WORD_LENGTH) return;
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (trie_next_child(trie, node, &cursor, &label, &child)) {
+        prefix[level] = label;
+        // The rest of an edge of a radix trie is copied at once, up to its node
+        const uint8_t *rest = NULL;
+        int restLength = trie_edge_rest(trie, child, &rest);
+        if (level + 1 + restLength >= MAX_WORD_LENGTH) continue;
+        if (restLength) memcpy(prefix + level + 1, rest, restLength);
+        collect_index_words(builder, trie, trie_edge_node(trie, child), prefix, level + 1 + restLength);
+    }
+}
+
+// Visitor recording a deletion variant of the word being indexed
+static void add_delete_pair(uint64_t hash, void *context) {
+    SymSpellBuilder *builder = (SymSpellBuilder *)context;
+    if (builder->pairCount == builder->pairCapacity) {
+        builder->pairCapacity = builder->pairCapacity ? builder->pairCapacity * 2 : 1024;
+        builder->pairs = (DeletePair *)realloc(builder->pairs, builder->pairCapacity * sizeof(DeletePair));
+        if (builder->pairs == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    builder->pairs[builder->pairCount].hash = hash;
+    builder->pairs[builder->pairCount].word = builder->currentWord;
+    builder->pairCount++;
+}
+
+// Comparison of two pairs by hash and then by word id, for qsort
+static int compare_delete_pairs(const void *a, const void *b) {
+    const DeletePair *x = (const DeletePair *)a;
+    const DeletePair *y = (const DeletePair *)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->word > y->word) - (x->word < y->word);
+}
+
+// Function to build the SymSpell index from every word of a trie
+void build_symspell_index(SymSpellIndex *index, Trie *trie) {
+    memset(index, 0, sizeof(*index));
+    SymSpellBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.index = index;
+
+    char prefix[MAX_WORD_LENGTH];
+    collect_index_words(&builder, trie, trie->root, prefix, 0);
+
+    for (uint32_t w = 0; w < index->wordCount; w++) {
+        builder.currentWord = w;
+        const char *word = index->strings + index->wordOffsets[w];
+        visit_deletes(word, strlen(word), 0, 0, add_delete_pair, &builder);
+    }
+
+    // Sorting groups the words of each variant together and exposes the duplicates
+    qsort(builder.pairs, builder.pairCount, sizeof(DeletePair), compare_delete_pairs);
+    size_t unique = 0;
+    uint32_t distinctHashes = 0;
+    for (size_t i = 0; i < builder.pairCount; i++) {
+        if (unique > 0 && builder.pairs[unique - 1].hash == builder.pairs[i].hash && builder.pairs[unique - 1].word == builder.pairs[i].word) {
+            continue;
+        }
+        if (unique == 0 || builder.pairs[unique - 1].hash != builder.pairs[i].hash) {
+            distinctHashes++;
+        }
+        builder.pairs[unique++] = builder.pairs[i];
+    }
+
+    // The table is kept at most half full so probe sequences stay short
+    index->slotCount = 16;
+    while (index->slotCount < 2 * distinctHashes) {
+        index->slotCount *= 2;
+    }
+    index->slots = (SymSpellSlot *)calloc(index->slotCount, sizeof(SymSpellSlot));
+    index->postingCount = unique;
+    index->postings = (uint32_t *)malloc((unique ? unique : 1) * sizeof(uint32_t));
+    if (index->slots == NULL || index->postings == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    uint32_t mask = index->slotCount - 1;
+    for (size_t i = 0; i < unique; ) {
+        uint64_t hash = builder.pairs[i].hash;
+        uint32_t slot = (uint32_t)hash & mask;
+        while (index->slots[slot].hash != 0) {
+            slot = (slot + 1) & mask;
+        }
+        index->slots[slot].hash = hash;
+        index->slots[slot].start = i;
+        while (i < unique && builder.pairs[i].hash == hash) {
+            index->postings[i] = builder.pairs[i].word;
+            i++;
+        }
+        index->slots[slot].count = i - index->slots[slot].start;
+    }
+    free(builder.pairs);
+}
+
+// Function to get the number of bytes used by the SymSpell index
+size_t symspell_memory_bytes(const SymSpellIndex *index) {
+    return (size_t)index->wordCount * (sizeof(uint32_t) + sizeof(float))
+        + (size_t)index->slotCount * sizeof(SymSpellSlot)
+        + (size_t)index->postingCount * sizeof(uint32_t)
+        + index->stringBytes;
+}
+
+// Structure of the word ids gathered while looking up the deletion variants of an input
+typedef struct SymSpellLookup {
+    const SymSpellIndex *index;
+    uint32_t *candidates;
+    uint32_t count;
+    uint32_t capacity;
+} SymSpellLookup;
+
+// Visitor adding the words which share a deletion variant with the input
+static void add_lookup_candidates(uint64_t hash, void *context) {
+    SymSpellLookup *lookup = (SymSpellLookup *)context;
+    const SymSpellIndex *index = lookup->index;
+    uint32_t mask = index->slotCount - 1;
+    for (uint32_t slot = (uint32_t)hash & mask; index->slots[slot].hash != 0; slot = (slot + 1) & mask) {
+        if (index->slots[slot].hash == hash) {
+            const SymSpellSlot *found = &index->slots[slot];
+            lookup->candidates = (uint32_t *)grow_buffer(lookup->candidates, &lookup->capacity, lookup->count + found->count, sizeof(uint32_t));
+            memcpy(lookup->candidates + lookup->count, index->postings + found->start, found->count * sizeof(uint32_t));
+            lookup->count += found->count;
+            return;
+        }
+    }
+}
+
+// Comparison of two word ids, for qsort
+static int compare_word_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to collect the words within LEVENSHTEIN_LIMIT of the input from the SymSpell index, without walking any trie
+void collect_symspell_suggestions(const SymSpellIndex *index, CorrectionSet *set, const char *input, int input_length, double alpha, double max_weight) {
+    SymSpellLookup lookup = {index, NULL, 0, 0};
+    visit_deletes(input, input_length, 0, 0, add_lookup_candidates, &lookup);
+
+    // A word can share several variants with the input, and hash collisions can bring in unrelated
+    // words, so the candidates are deduplicated and their real distance is checked
+    qsort(lookup.candidates, lookup.count, sizeof(uint32_t), compare_word_ids);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < lookup.count; i++) {
+        if (unique == 0 || lookup.candidates[i] != lookup.candidates[unique - 1]) {
+            lookup.candidates[unique++] = lookup.candidates[i];
+        }
+    }
+    if (unique == 0) {
+        free(lookup.candidates);
+        return;
+    }
+    const char **words = (const char **)malloc(unique * sizeof(char *));
+    int *distances = (int *)malloc(unique * sizeof(int));
+    if (words == NULL || distances == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < unique; i++) {
+        words[i] = index->strings + index->wordOffsets[lookup.candidates[i]];
+    }
+    levenshtein_batch(input, input_length, words, unique, LEVENSHTEIN_LIMIT, distances);
+    for (uint32_t i = 0; i < unique; i++) {
+        if (distances[i] <= LEVENSHTEIN_LIMIT) {
+            add_correction(set, words[i], distances[i], index->wordWeights[lookup.candidates[i]], alpha, max_weight);
+        }
+    }
+    free(words);
+    free(distances);
+    free(lookup.candidates);
+}
+
+// Structure of a growing piece of text, in which the answer to a query is written before it is printed
+typedef struct TextBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+// Function to append formatted text to a TextBuffer
+void text_printf(TextBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0) return;
+    if (buffer->length + needed + 1 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (buffer->length + needed + 1 > capacity) capacity *= 2;
+        char *data = (char *)realloc(buffer->data, capacity);
+        if (data == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+    va_end(args);
+    buffer->length += needed;
+}
+
+// Structure of the buffers an auto-correct query works in. Each thread allocates its own once
+// instead of putting them on the stack of every call.
+typedef struct QueryScratch {
+    CorrectionSet candidates;
+    Suggestion *best;
+    int (*rows)[MAX_WORD_LENGTH + 1];
+} QueryScratch;
+
+static _Thread_local QueryScratch queryScratch;
+
+// Function to get the query buffers of the calling thread
+QueryScratch *get_query_scratch(void) {
+    if (queryScratch.best == NULL) {
+        queryScratch.best = (Suggestion *)malloc(MAX_CORRECTION_CANDIDATES * sizeof(Suggestion));
+        queryScratch.rows = malloc((MAX_WORD_LENGTH + 1) * sizeof(*queryScratch.rows));
+        if (queryScratch.best == NULL || queryScratch.rows == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+    }
+    return &queryScratch;
+}
+
+// Function to free the query buffers of the calling thread
+void release_query_scratch(void) {
+    free_correction_set(&queryScratch.candidates);
+    free(queryScratch.best);
+    free(queryScratch.rows);
+    queryScratch.best = NULL;
+    queryScratch.rows = NULL;
+}
+
+#ifdef AUTOFILL_STATS
+// Function to account for a query started at the given counters and time, and to write what it did
+// into out when queries are traced
+static void stats_end_query(const Stats *before, double start, TextBuffer *out) {
+    double seconds = stats_now() - start;
+    threadStats.querySeconds += seconds;
+    threadStats.queries++;
+    if (!traceQueries) return;
+    text_printf(out, "[trace] fill nodes %llu, correct nodes %llu, levenshtein calls %llu, cells %llu, %.1f us\n",
+        threadStats.fillNodesVisited - before->fillNodesVisited,
+        threadStats.correctNodesVisited - before->correctNodesVisited,
+        threadStats.levenshteinCalls - before->levenshteinCalls,
+        threadStats.levenshteinCells - before->levenshteinCells, seconds * 1e6);
+}
+
+#define QUERY_TRACE_BEGIN() Stats queryBefore = threadStats; double queryStart = stats_now()
+#define QUERY_TRACE_END(out) stats_end_query(&queryBefore, queryStart, out)
+#else
+#define QUERY_TRACE_BEGIN() ((void)0)
+#define QUERY_TRACE_END(out) ((void)0)
+#endif
+
+// Function to collect the corrections of a word from both tries and write the best max of them to suggestions,
+// sorted by score, returning how many were written. When a SymSpell index of the past trie is given, it is
+// used instead of walking the past trie.
+int find_corrections(Trie *currentTrie, Trie *pastTrie, const SymSpellIndex *pastIndex, const char *input, double alpha, Suggestion *suggestions, int max) {
+    char prefix[MAX_WORD_LENGTH] = "";
+    int input_length = strlen(input);
+    if (input_length >= MAX_WORD_LENGTH) {
+        return 0;
+    }
+    // One row of the edit distance table per letter of the prefix being walked
+    QueryScratch *scratch = get_query_scratch();
+    int (*rows)[MAX_WORD_LENGTH + 1] = scratch->rows;
+    CorrectionSet *set = &scratch->candidates;
+    clear_correction_set(set);
+    for (int j = 0; j <= input_length; j++) {
+        rows[0][j] = j;
+    }
+
+    double max_weight_current = 1.0, max_weight_past = 1.0;
+    bool reading = begin_query(currentTrie);
+
+    // Getting the maximum weight for normalization
+    max_weight_current = trie_weight(currentTrie, currentTrie->root) ? trie_weight(currentTrie, currentTrie->root) : 1.0;
+    max_weight_past = trie_weight(pastTrie, pastTrie->root) ? trie_weight(pastTrie, pastTrie->root) : 1.0;
+
+    // Collecting the words of any length within the distance limit from both tries. A unified trie
+    // also holds the words of the corpus, so its walk finds them all.
+    collect_suggestions(currentTrie, currentTrie->root, prefix, 0, rows, set, input, input_length, alpha, max_weight_current);
+    if (!currentTrie->unified) {
+        if (pastIndex) {
+            collect_symspell_suggestions(pastIndex, set, input, input_length, alpha, max_weight_past);
+        } else {
+            collect_suggestions(pastTrie, pastTrie->root, prefix, 0, rows, set, input, input_length, alpha, max_weight_past);
+        }
+    }
+    if (reading) end_trie_read();
+
+    // Selecting the best suggestions based on score
+    return best_corrections(set, suggestions, max);
+}
+
+// Function to suggest words based on combined score and edit distance for the purpose of auto-correct
+void suggest_words_for_correction(Trie *currentTrie, Trie *pastTrie, const SymSpellIndex *pastIndex, const char *input, double alpha, TextBuffer *out) {
+    Suggestion *suggestions = get_query_scratch()->best;
+    int count = find_corrections(currentTrie, pastTrie, pastIndex, input, alpha, suggestions, MAX_CORRECTION_CANDIDATES);
+
+    // Checking if the suggestions are found or not
+    if(count == 0 || suggestions[0].score == 0){
+        text_printf(out, "No suggestions found for '%s'\n", input);
+        return;
+    }
+
+    text_printf(out, "Suggestions for '%s':\n", input);
+    for (int i = 0; i < count; i++) {
+        text_printf(out, "%s (Score: %.2f)\n", suggestions[i].word, suggestions[i].score);
+    }
+}
+
+// Most prefixes fuzzy completion starts from, and most letters compared and entries expanded by a
+// query, of which the walks leave FUZZY_COMPLETION_NODES to complete the prefixes they find. The walks
+// look for one typo before two. The first letters of a word are rarely mistyped, and keeping them
+// leaves a small part of the trie to walk.
+#define FUZZY_MAX_STARTS 32
+#define FUZZY_NODE_BUDGET 4096
+#define FUZZY_COMPLETION_NODES 1024
+#define FUZZY_EXACT_LETTERS 1
+
+// Structure of a prefix of the tries which matches the input of fuzzy completion with some typos
+typedef struct FuzzyStart {
+    char path[MAX_WORD_LENGTH];
+    int distance;
+} FuzzyStart;
+
+// Structure of the walks of fuzzy completion, which keep the prefixes matching the input with exactly
+// edits typos
+typedef struct FuzzyWalk {
+    const char *input;
+    int inputLength;
+    int edits;
+    int budget;
+    int (*rows)[MAX_WORD_LENGTH + 1];
+    char path[MAX_WORD_LENGTH];
+    FuzzyStart starts[FUZZY_MAX_STARTS];
+    int startCount;
+} FuzzyWalk;
+
+// Function to get the most typos allowed in a prefix, which is one for the short ones as almost any
+// two short prefixes with the same first letter are two typos apart
+static int fuzzy_edit_limit(int length) {
+    return length <= 5 ? 1 : LEVENSHTEIN_LIMIT;
+}
+
+// Function to keep a prefix matching the input with the typos of the walk, unless it was kept already
+static void add_fuzzy_start(FuzzyWalk *walk, int length) {
+    walk->path[length] = '\0';
+    for (int i = 0; i < walk->startCount; i++) {
+        if (strcmp(walk->starts[i].path, walk->path) == 0) return;
+    }
+    memcpy(walk->starts[walk->startCount].path, walk->path, length + 1);
+    walk->starts[walk->startCount].distance = walk->edits;
+    walk->startCount++;
+}
+
+// Recursive function to walk the paths below a node with one row of the edit distance table per letter,
+// as auto-correct does, but against the input as a prefix. A path stops at its first node matching the
+// whole input within the typos of the walk: the words below it are its completions, and a node below it
+// with fewer typos was kept by a previous walk. A path also stops once it is too far from the input.
+static void walk_fuzzy_prefixes(const Trie *trie, NodeId node, int level, FuzzyWalk *walk) {
+    if (level + 1 >= MAX_WORD_LENGTH) return;
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (walk->budget > FUZZY_COMPLETION_NODES && walk->startCount < FUZZY_MAX_STARTS && trie_next_child(trie, node, &cursor, &label, &child)) {
+        if (level < FUZZY_EXACT_LETTERS && level < walk->inputLength && label != (unsigned char)walk->input[level]) continue;
+        walk->budget--;
+        int rowMin = next_distance_row(walk->rows[level], walk->rows[level + 1], walk->input, walk->inputLength, (char)label);
+        walk->path[level] = (char)label;
+        int depth = level + 1;
+        int distance = walk->rows[depth][walk->inputLength];
+        // In a radix trie, the edge is compared letter by letter until the input matches, and the rest of
+        // it belongs to the prefix of every completion
+        const uint8_t *rest = NULL;
+        int restLength = trie_edge_rest(trie, child, &rest);
+        int k = 0;
+        for (; k < restLength && rowMin <= walk->edits && distance > walk->edits && depth + 1 < MAX_WORD_LENGTH && walk->budget > FUZZY_COMPLETION_NODES; k++, depth++) {
+            walk->budget--;
+            rowMin = next_distance_row(walk->rows[depth], walk->rows[depth + 1], walk->input, walk->inputLength, (char)rest[k]);
+            walk->path[depth] = (char)rest[k];
+            distance = walk->rows[depth + 1][walk->inputLength];
+        }
+        if (distance <= walk->edits) {
+            for (; k < restLength; k++) {
+                walk->path[depth++] = (char)rest[k];
+            }
+            if (distance == walk->edits) add_fuzzy_start(walk, depth);
+        } else if (rowMin <= walk->edits && k == restLength) {
+            walk_fuzzy_prefixes(trie, trie_edge_node(trie, child), depth, walk);
+        }
+    }
+}
+
+// Function to find the best completions of an input whose letters may have typos, as auto-fill with
+// auto-correct on the prefix. It is meant for an input with no completion of its own, so the tries are
+// walked for the prefixes matching the input with one typo, then two, and the first
+// FUZZY_EXACT_LETTERS letters of the input are never changed. Each of them is completed like a prefix
+// of auto-fill, and the completions are ranked as corrections, from their combined weight and the
+// typos of their prefix. The letters compared by the walks and by finding the prefixes, and the
+// entries expanded to complete them, all count against FUZZY_NODE_BUDGET.
+int find_fuzzy_completions(Trie *corpus, Trie *main, const char *input, double alpha, Suggestion *suggestions, int max) {
+    int inputLength = strlen(input);
+    if (inputLength == 0 || inputLength >= MAX_WORD_LENGTH) return 0;
+    if (max > MAX_SUGGESTIONS) max = MAX_SUGGESTIONS;
+    FuzzyWalk *walk = (FuzzyWalk *)malloc(sizeof(FuzzyWalk));
+    if (walk == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    walk->input = input;
+    walk->inputLength = inputLength;
+    walk->budget = FUZZY_NODE_BUDGET;
+    walk->rows = get_query_scratch()->rows;
+    walk->startCount = 0;
+    for (int j = 0; j <= inputLength; j++) {
+        walk->rows[0][j] = j;
+    }
+    bool reading = begin_query(main);
+    int editLimit = fuzzy_edit_limit(inputLength);
+    for (walk->edits = 1; walk->edits <= editLimit && walk->budget > FUZZY_COMPLETION_NODES; walk->edits++) {
+        walk_fuzzy_prefixes(corpus, corpus->root, 0, walk);
+        // A unified trie is both the corpus and the main trie
+        if (!corpus->unified) walk_fuzzy_prefixes(main, main->root, 0, walk);
+    }
+
+    // A word below several of the prefixes keeps its best score
+    Suggestion candidates[FUZZY_MAX_STARTS * MAX_SUGGESTIONS];
+    int candidateCount = 0;
+    for (int i = 0; i < walk->startCount && walk->budget > 0; i++) {
+        FuzzyStart *start = &walk->starts[i];
+        // Finding the prefix compares its letters in both tries
+        int lookupCost = (corpus->unified ? 1 : 2) * (int)strlen(start->path);
+        if (lookupCost >= walk->budget) break;
+        walk->budget -= lookupCost;
+        NodeId corpusNode = findPrefixNode(corpus, start->path);
+        NodeId mainNode = corpus->unified ? NULL_NODE : findPrefixNode(main, start->path);
+        char words[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+        double weights[MAX_SUGGESTIONS];
+        int count = 0;
+        suggest_words_within(corpus, corpusNode, main, mainNode, start->path, words, weights, &count, max, &walk->budget);
+        for (int w = 0; w < count; w++) {
+            double score = alpha * (1.0 / (start->distance + 1)) + (1 - alpha) * weights[w];
+            int c = 0;
+            while (c < candidateCount && strcmp(candidates[c].word, words[w]) != 0) c++;
+            if (c == candidateCount) {
+                strcpy(candidates[candidateCount].word, words[w]);
+                candidates[candidateCount].score = score;
+                candidates[candidateCount].combined = false;
+                candidateCount++;
+            } else if (score > candidates[c].score) {
+                candidates[c].score = score;
+            }
+        }
+    }
+    if (reading) end_trie_read();
+    free(walk);
+
+    // Selecting the best candidates, the first word in alphabetical order among equal scores
+    int found = 0;
+    for (; found < max && found < candidateCount; found++) {
+        int best = found;
+        for (int c = found + 1; c < candidateCount; c++) {
+            if (candidates[c].score > candidates[best].score
+                || (candidates[c].score == candidates[best].score && strcmp(candidates[c].word, candidates[best].word) < 0)) {
+                best = c;
+            }
+        }
+        suggestions[found] = candidates[best];
+        candidates[best] = candidates[found];
+    }
+    return found;
+}
+
+// Function to get the n-gram model of the words of a corpus trie. A unified trie reads it from the
+// corpus trie it was built from.
+static const NgramModel *corpus_ngrams(const Trie *corpus) {
+    return corpus->unified ? corpus->corpusNgrams : &corpus->ngrams;
+}
+
+// Function to get how likely a word is after the words of the sentence before it, from the n-grams of
+// the user and of the corpus, combined as their weights are
+static double context_score(Trie *corpus, Trie *main, const uint64_t *context, int contextCount, const char *word) {
+    uint64_t hash = hash_word(word, strlen(word));
+    double userProbability = ngram_probability(&main->ngrams, context, contextCount, hash);
+    const NgramModel *corpusModel = corpus_ngrams(corpus);
+    double corpusProbability = corpusModel ? ngram_probability(corpusModel, context, contextCount, hash) : 0;
+    return combineWeights(userProbability, corpusProbability);
+}
+
+// Function to get the combined weight of a whole word from both tries
+static double word_weight(Trie *corpus, Trie *main, const char *word) {
+    NodeId corpusNode = findPrefixNode(corpus, word);
+    if (corpus->unified) {
+        if (!corpusNode) return 0;
+        TrieNode *node = get_node(corpus, corpusNode);
+        return combineWeights(unified_user_weight(corpus, node), normalize_weight(node->weight, corpus->maxWeight));
+    }
+    // A node which ends no word has a weight of 0
+    return getCombinedWeight(main, findPrefixNode(main, word), corpus, corpusNode);
+}
+
+// Function to print the best suggestions by score, keeping the order they were found in between equal scores
+static void print_ranked(TextBuffer *out, char suggestions[][MAX_WORD_LENGTH], const double scores[], int count) {
+    int order[MAX_SUGGESTIONS * NGRAM_RERANK_FACTOR];
+    for (int i = 0; i < count; i++) {
+        int pos = i;
+        while (pos > 0 && scores[order[pos - 1]] < scores[i]) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = i;
+    }
+    for (int i = 0; i < count && i < MAX_SUGGESTIONS; i++) {
+        text_printf(out, "%s (Weight: %.4f)\n", suggestions[order[i]], scores[order[i]]);
+    }
+}
+
+// Function to suggest the top completions of the last word of a sentence for the purpose of auto-fill.
+// The words learned before it in the main trie are the context of the sentence: more completions are
+// then found by weight, and ranked again with how likely each one is after those words.
+void suggest_completions(Trie *corpus, Trie *main, char *lastWord, TextBuffer *out) {
+    bool reading = begin_query(main);
+    uint64_t context[2];
+    int contextCount = ngram_context(&main->ngrams, context);
+    char suggestions[MAX_SUGGESTIONS * NGRAM_RERANK_FACTOR][MAX_WORD_LENGTH];
+    double weights[MAX_SUGGESTIONS * NGRAM_RERANK_FACTOR] = {0};
+    int suggestionCount = 0;
+
+    // The suggestions come out already ordered by weight
+    int candidates = contextCount ? MAX_SUGGESTIONS * NGRAM_RERANK_FACTOR : MAX_SUGGESTIONS;
+    PrefixCache *cache = main->prefixCache;
+    if (!cache || !prefix_cache_lookup(cache, main, lastWord, suggestions, weights, &suggestionCount, candidates)) {
+        NodeId prefixCorpusNode = findPrefixNode(corpus, lastWord);
+        // A unified trie is both the corpus and the main trie
+        NodeId prefixMainNode = main->unified ? NULL_NODE : findPrefixNode(main, lastWord);
+        // The cache keeps as many completions as any query wants
+        suggestWords(corpus, prefixCorpusNode, main, prefixMainNode, lastWord, suggestions, weights, &suggestionCount, cache ? PREFIX_CACHE_RESULTS : candidates);
+        if (cache) {
+            prefix_cache_store(cache, main, lastWord, suggestions, weights, suggestionCount);
+            if (suggestionCount > candidates) suggestionCount = candidates;
+        }
+    }
+    // A unified trie can keep the nodes of user words it has forgotten, with no word below them. When
+    // nothing completes the word, it may have a typo, and the words completing it once corrected are given.
+    if (suggestionCount == 0) {
+        if (reading) end_trie_read();
+        Suggestion fuzzy[MAX_SUGGESTIONS];
+        int fuzzyCount = find_fuzzy_completions(corpus, main, lastWord, 0.7, fuzzy, MAX_SUGGESTIONS);
+        if (fuzzyCount == 0) {
+            text_printf(out, "No suggestions found for \"%s\"\n", lastWord);
+            return;
+        }
+        text_printf(out, "No completions of \"%s\", did you mean:\n", lastWord);
+        for (int i = 0; i < fuzzyCount; i++) {
+            text_printf(out, "%s (Score: %.2f)\n", fuzzy[i].word, fuzzy[i].score);
+        }
+        return;
+    }
+    for (int i = 0; contextCount && i < suggestionCount; i++) {
+        weights[i] += context_score(corpus, main, context, contextCount, suggestions[i]);
+    }
+    if (reading) end_trie_read();
+
+    text_printf(out, "Top suggestions for \"%s\":\n", lastWord);
+    print_ranked(out, suggestions, weights, suggestionCount);
+}
+
+// Function to predict the word following a sentence for the purpose of auto-fill. The candidates are the
+// best next words of the last word in the n-grams of the user and of the corpus, ranked by their weight
+// and by how likely they are after the last words of the sentence.
+void suggest_next_words(Trie *corpus, Trie *main, const char *lastWord, TextBuffer *out) {
+    bool reading = begin_query(main);
+    uint64_t context[2];
+    int contextCount = ngram_context(&main->ngrams, context);
+    uint64_t last = hash_word(lastWord, strlen(lastWord));
+    char suggestions[2 * NGRAM_FOLLOWERS][MAX_WORD_LENGTH];
+    double scores[2 * NGRAM_FOLLOWERS];
+    int count = ngram_next_words(&main->ngrams, main, last, suggestions, NGRAM_FOLLOWERS);
+    const NgramModel *corpusModel = corpus_ngrams(corpus);
+    if (corpusModel) {
+        char corpusNext[NGRAM_FOLLOWERS][MAX_WORD_LENGTH];
+        int corpusCount = ngram_next_words(corpusModel, corpus, last, corpusNext, NGRAM_FOLLOWERS);
+        for (int i = 0; i < corpusCount; i++) {
+            bool seen = false;
+            for (int j = 0; j < count && !seen; j++) {
+                seen = strcmp(suggestions[j], corpusNext[i]) == 0;
+            }
+            if (!seen) strcpy(suggestions[count++], corpusNext[i]);
+        }
+    }
+    if (count == 0) {
+        if (reading) end_trie_read();
+        text_printf(out, "No next word suggestions after \"%s\"\n", lastWord);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        scores[i] = word_weight(corpus, main, suggestions[i]) + context_score(corpus, main, context, contextCount, suggestions[i]);
+    }
+    if (reading) end_trie_read();
+
+    text_printf(out, "Next word suggestions after \"%s\":\n", lastWord);
+    print_ranked(out, suggestions, scores, count);
+}
+
+// The learning memory is defined after the snapshot functions it is built on
+typedef struct LearningMemory LearningMemory;
+void learning_memory_learn(LearningMemory *memory, const char *word, int length, uint32_t time);
+
+// Function to learn a word of a sentence in the main Trie, at the time of the sentence, with the n-grams
+// it ends. In unified mode it is learned as a user word of the unified trie.
+static void learn_sentence_word(Trie *main, LearningMemory *memory, const char *word, uint32_t now) {
+    int length = strlen(word);
+    if (main->unified) {
+        insert_user_word(main, word, length, now);
+    } else {
+        learn_word(main, word, length, now);
+        if (memory) {
+            learning_memory_learn(memory, word, length, now);
+        }
+    }
+    ngram_add_word(&main->ngrams, hash_word(word, length));
+}
+
+// Function to answer one input sentence: every word but the last is learned in the main Trie, and the
+// last word is completed ('f') or corrected ('c'). Words are the runs of letters of the sentence, which
+// is lowercased in place. In unified mode, corpus and main are the same unified trie and the words are
+// learned as its user words. When a learning memory is given, the learned words are also queued to it.
+// The words are learned with the time of the sentence, from which their weights decay. A sentence ending
+// with a space is followed by a new word: in auto-fill, its last word is learned too and the next word
+// is predicted.
+void answer_sentence(Trie *corpus, const SymSpellIndex *index, Trie *main, LearningMemory *memory, char choice, char *sentence, TextBuffer *out) {
+    char lastWord[MAX_WORD_LENGTH] = "";
+    uint32_t now = recency_now();
+    // The sentence does not follow the words learned from the previous ones
+    ngram_new_text(&main->ngrams);
+    int i = 0;
+    while (sentence[i]) {
+        unsigned char c = (unsigned char)sentence[i];
+        if (!is_word_byte(c) || utf8_separator_length(c)) {
+            // The whole UTF-8 separator is skipped, so its other bytes do not start a word
+            int width = utf8_separator_length(c);
+            do i++; while (--width > 0 && sentence[i]);
+            continue;
+        }
+        int start = i;
+        for (; is_word_byte((unsigned char)sentence[i]) && !utf8_separator_length((unsigned char)sentence[i]); i++) {
+            sentence[i] = lower_word_byte((unsigned char)sentence[i]);
+        }
+        // A new word follows the previous one, which is therefore not the last word
+        if (lastWord[0]) {
+            learn_sentence_word(main, memory, lastWord, now);
+        }
+        // Words too long for the trie are skipped
+        int length = i - start;
+        if (length < MAX_WORD_LENGTH) {
+            memcpy(lastWord, sentence + start, length);
+            lastWord[length] = '\0';
+        } else {
+            lastWord[0] = '\0';
+        }
+    }
+    // Checking if the last word is valid or not
+    if (strlen(lastWord) == 0) {
+        text_printf(out, "No valid last word entered.\n");
+        return;
+    }
+
+    QUERY_TRACE_BEGIN();
+    if (choice == 'f' && i > 0 && sentence[i - 1] == ' ') {
+        // Next word prediction, from the whole sentence
+        learn_sentence_word(main, memory, lastWord, now);
+        suggest_next_words(corpus, main, lastWord, out);
+    } else if (choice == 'f') {
+        // Auto-fill functionality
+        suggest_completions(corpus, main, lastWord, out);
+    } else if (choice == 'c') {
+        // Auto-correct functionality
+        suggest_words_for_correction(main, corpus, index, lastWord, 0.7, out);
+    } else {
+        text_printf(out, "Invalid choice. Enter 'f', 'c' or 's'.\n");
+    }
+    QUERY_TRACE_END(out);
+}
+
+
+// Size of the blocks a corpus stream is read in
+#define TOKENIZER_BLOCK (1 << 20)
+
+// Function to find the bytes of words among 64 bytes: bit i of the result is set when data[i] is an
+// ASCII letter or a byte of a UTF-8 character, and the 64 bytes are written to out with the ASCII letters
+// lowercased. The first bytes of the UTF-8 separators are marked in separators, for the caller to clear them.
+static inline uint64_t classify_letters(const unsigned char *data, unsigned char *out, uint64_t *separators) {
+    uint64_t mask = 0;
+    uint64_t marks = 0;
+#ifdef __SSE2__
+    // Setting bit 5 lowercases a letter, and shifting 'a' to -128 lets a signed compare check 'a'..'z'.
+    // Bytes from 0x80 are negative as signed bytes and are kept as they are.
+    const __m128i lowerBit = _mm_set1_epi8(0x20);
+    const __m128i shift = _mm_set1_epi8((char)(128 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + Total_Alphabets));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i latin1 = _mm_set1_epi8((char)0xC2);
+    const __m128i punctuation = _mm_set1_epi8((char)0xE2);
+    for (int i = 0; i < 64; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i high = _mm_cmplt_epi8(bytes, zero);
+        __m128i lower = _mm_or_si128(bytes, _mm_andnot_si128(high, lowerBit));
+        __m128i letters = _mm_or_si128(_mm_cmplt_epi8(_mm_add_epi8(lower, shift), limit), high);
+        __m128i leads = _mm_or_si128(_mm_cmpeq_epi8(bytes, latin1), _mm_cmpeq_epi8(bytes, punctuation));
+        _mm_storeu_si128((__m128i *)(out + i), lower);
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(letters) << i;
+        marks |= (uint64_t)(uint16_t)_mm_movemask_epi8(leads) << i;
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        out[i] = lower_word_byte(data[i]);
+        if (is_word_byte(data[i])) mask |= 1ULL << i;
+        if (utf8_separator_length(data[i])) marks |= 1ULL << i;
+    }
+#endif
+    *separators = marks;
+    return mask;
+}
+
+// Structure of the state of the tokenizer between blocks: the part of a word cut by the end of a block
+typedef struct Tokenizer {
+    Trie *trie;
+    char word[MAX_WORD_LENGTH];
+    int length;
+    // Set while the current word is longer than MAX_WORD_LENGTH, which is skipped instead of being cut
+    bool tooLong;
+    // Number of bytes of a UTF-8 separator cut by the end of the previous block or group
+    int separatorBytes;
+} Tokenizer;
+
+// Function to start tokenizing a text into a trie
+static void tokenizer_start(Tokenizer *tokenizer, Trie *trie) {
+    tokenizer->trie = trie;
+    tokenizer->length = 0;
+    tokenizer->tooLong = false;
+    tokenizer->separatorBytes = 0;
+}
+
+// Function to add a run of lowercased letters to the word being read
+static void tokenizer_append(Tokenizer *tokenizer, const unsigned char *letters, int count) {
+    if (tokenizer->tooLong) return;
+    if (tokenizer->length + count > MAX_WORD_LENGTH - 1) {
+        tokenizer->tooLong = true;
+        return;
+    }
+    memcpy(tokenizer->word + tokenizer->length, letters, count);
+    tokenizer->length += count;
+}
+
+// Function to insert a word read from the text in the trie, and to count the n-grams it ends
+static inline void tokenizer_word(Tokenizer *tokenizer, const char *word, int length) {
+    insert_word(tokenizer->trie, word, length);
+    ngram_add_word(&tokenizer->trie->ngrams, hash_word(word, length));
+}
+
+// Function to insert the word being read, if any, once a non-letter ends it
+static void tokenizer_end_word(Tokenizer *tokenizer) {
+    if (tokenizer->length > 0 && !tokenizer->tooLong) {
+        tokenizer_word(tokenizer, tokenizer->word, tokenizer->length);
+    }
+    tokenizer->length = 0;
+    tokenizer->tooLong = false;
+}
+
+// Function to tokenize a block of text, 64 bytes at a time. Each group of bytes is classified at once,
+// and the words are then found by jumping between the first letters and the first non-letters of the mask.
+// A word which lies inside one group is inserted straight from the lowercased bytes, without a copy.
+static void tokenizer_feed(Tokenizer *tokenizer, const char *data, size_t length) {
+    unsigned char lowered[64];
+    unsigned char padded[64];
+    for (size_t base = 0; base < length; base += 64) {
+        size_t n = length - base < 64 ? length - base : 64;
+        const unsigned char *group = (const unsigned char *)data + base;
+        if (n < 64) {
+            // The last bytes are padded with spaces, which end any word
+            memset(padded, ' ', sizeof(padded));
+            memcpy(padded, group, n);
+            group = padded;
+        }
+        uint64_t separators;
+        uint64_t letters = classify_letters(group, lowered, &separators);
+        // Clearing the bytes of the UTF-8 separators, which are rare enough to be handled one at a time
+        int carried = tokenizer->separatorBytes < (int)n ? tokenizer->separatorBytes : (int)n;
+        letters &= ~0ULL << carried;
+        tokenizer->separatorBytes -= carried;
+        for (; separators; separators &= separators - 1) {
+            int i = __builtin_ctzll(separators);
+            int width = utf8_separator_length(group[i]);
+            letters &= ~(((1ULL << width) - 1) << i);
+            if (i + width > (int)n) tokenizer->separatorBytes = i + width - (int)n;
+        }
+
+        int pos = 0;
+        while (pos < (int)n) {
+            bool inWord = tokenizer->length > 0 || tokenizer->tooLong;
+            if (!inWord) {
+                uint64_t ahead = letters >> pos;
+                if (ahead == 0) break;
+                pos += __builtin_ctzll(ahead);
+                if (pos >= (int)n) break;
+            }
+            // Finding the end of the run of letters starting at pos
+            uint64_t others = ~letters >> pos;
+            int end = others ? pos + __builtin_ctzll(others) : 64;
+            if (end > (int)n) end = n;
+            if (end < (int)n && !inWord) {
+                if (end - pos <= MAX_WORD_LENGTH - 1) {
+                    tokenizer_word(tokenizer, (const char *)lowered + pos, end - pos);
+                }
+            } else {
+                tokenizer_append(tokenizer, lowered + pos, end - pos);
+                if (end < (int)n) tokenizer_end_word(tokenizer);
+            }
+            pos = end;
+        }
+    }
+}
+
+// Function to insert the last word of a text, which no non-letter has ended
+static void tokenizer_finish(Tokenizer *tokenizer) {
+    tokenizer_end_word(tokenizer);
+}
+
+// Function to clean and insert the words of a file, read as a stream of large blocks
+void insert_from_file(Trie *trie, FILE *f) {
+    char *block = (char *)malloc(TOKENIZER_BLOCK);
+    if (block == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    Tokenizer tokenizer;
+    tokenizer_start(&tokenizer, trie);
+    size_t length;
+    while ((length = fread(block, 1, TOKENIZER_BLOCK, f)) > 0) {
+        tokenizer_feed(&tokenizer, block, length);
+    }
+    tokenizer_finish(&tokenizer);
+    free(block);
+}
+
+// Function to clean and insert the words of a block of text held in memory
+void insert_from_buffer(Trie *trie, const char *data, size_t length) {
+    Tokenizer tokenizer;
+    tokenizer_start(&tokenizer, trie);
+    tokenizer_feed(&tokenizer, data, length);
+    tokenizer_finish(&tokenizer);
+}
+// Function to map a whole file read-only, or to read it into memory where mmap is not available
+static void *map_file(const char *path, size_t *size) {
+    void *data = NULL;
+#ifndef _WIN32
+    // A shared read-only mapping lets every process using the same file share its pages
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening file\n");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("Invalid file '%s'\n", path);
+        close(fd);
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error mapping '%s'\n", path);
+        return NULL;
+    }
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        printf("Error opening file\n");
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*size ? *size : 1);
+    if (!data || fread(data, 1, *size, f) != *size) {
+        printf("Error reading '%s'\n", path);
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+#endif
+    return data;
+}
+
+// Function to release a file obtained from map_file
+static void unmap_file(void *data, size_t size) {
+#ifndef _WIN32
+    munmap(data, size);
+#else
+    (void)size;
+    free(data);
+#endif
+}
+
+// Function to get the number of bytes used by the nodes of a Trie
+size_t trie_memory_bytes(const Trie *trie) {
+    if (trie->frozen) {
+        size_t recencyBytes = trie->recency ? 2 * sizeof(Recency) : 0;
+        // A node of a radix trie also has the start and the length of its edge, whose letters come on top
+        size_t edgeBytes = trie->radix ? sizeof(uint32_t) + sizeof(uint8_t) : 0;
+        return (size_t)trie->nodeCount * (2 * sizeof(uint32_t) + sizeof(NodeId) + sizeof(uint32_t) + sizeof(uint8_t) + recencyBytes + edgeBytes)
+            + trie->edgeBytes;
+    }
+    size_t bytes = (size_t)trie->slabCount * NODE_SLAB_SIZE * sizeof(TrieNode) + trie->slabCapacity * sizeof(TrieNode *);
+    for (int kind = 0; kind < CHILD_KINDS; kind++) {
+        bytes += (size_t)trie->childPools[kind].capacity * childBlockSizes[kind];
+    }
+    return bytes;
+}
+
+// Free Trie memory, releasing the whole pool slab by slab instead of walking the nodes
+void free_trie(Trie *trie) {
+    STAT_ADD(liveNodes, -(long long)trie->nodeCount);
+    for (uint32_t i = 0; i < trie->slabCount; i++) {
+        free(trie->slabs[i]);
+    }
+    free(trie->slabs);
+    free_child_pools(trie);
+    free_retired(&trie->retired);
+    trie->concurrent = false;
+    free_prefix_cache(trie->prefixCache);
+    trie->prefixCache = NULL;
+    free(trie->userTouched);
+    trie->userTouched = NULL;
+    trie->userTouchedCount = 0;
+    trie->userTouchedCapacity = 0;
+    if (trie->mapping) {
+        // The frozen arrays live inside the snapshot mapping
+        unmap_file(trie->mapping, trie->mappingSize);
+        init_ngrams(&trie->ngrams);
+    } else {
+        free_ngrams(&trie->ngrams);
+        free(trie->childCount);
+        free(trie->firstChild);
+        free(trie->labels);
+        free(trie->weights);
+        free(trie->subtreeMax);
+        free(trie->recency);
+        free(trie->subtreeRecency);
+        free(trie->edgeStart);
+        free(trie->edgeLength);
+        free(trie->edges);
+    }
+    trie->mapping = NULL;
+    trie->mappingSize = 0;
+    trie->slabs = NULL;
+    trie->slabCount = 0;
+    trie->slabCapacity = 0;
+    trie->nodeCount = 0;
+    trie->root = NULL_NODE;
+    trie->frozen = false;
+    trie->childCount = NULL;
+    trie->firstChild = NULL;
+    trie->labels = NULL;
+    trie->weights = NULL;
+    trie->subtreeMax = NULL;
+    trie->recency = NULL;
+    trie->subtreeRecency = NULL;
+    trie->radix = false;
+    trie->edgeStart = NULL;
+    trie->edgeLength = NULL;
+    trie->edges = NULL;
+    trie->edgeBytes = 0;
+}
+
+// Recursive function to add the words and weights below a node of one trie to the matching node of another
+static void merge_nodes(Trie *into, NodeId target, const Trie *from, NodeId source) {
+    const TrieNode *sourceNode = get_node(from, source);
+    // Slabs never move, so the target node stays valid while children are created below it
+    TrieNode *targetNode = get_node(into, target);
+    if (sourceNode->checkisEndOfWord) {
+        targetNode->checkisEndOfWord = true;
+        targetNode->weight += sourceNode->weight;
+        if (targetNode->subtreeMax < targetNode->weight) {
+            targetNode->subtreeMax = targetNode->weight;
+        }
+        if (into->maxWeight < targetNode->weight) {
+            into->maxWeight = targetNode->weight;
+        }
+    }
+    int cursor = 0;
+    unsigned char label;
+    NodeId sourceChild;
+    while (trie_next_child(from, source, &cursor, &label, &sourceChild)) {
+        NodeId targetChild = node_child(into, targetNode, label);
+        if (!targetChild) {
+            targetChild = create_node(into);
+            add_child(into, target, label, targetChild);
+        }
+        merge_nodes(into, targetChild, from, sourceChild);
+        uint32_t childMax = get_node(into, targetChild)->subtreeMax;
+        if (targetNode->subtreeMax < childMax) {
+            targetNode->subtreeMax = childMax;
+        }
+    }
+}
+
+// Function to add every word of a trie, with its weight, to another trie. The words of the other trie
+// are taken to follow the words of the first one in the text, for the n-grams they form together.
+void merge_trie(Trie *into, const Trie *from) {
+    merge_nodes(into, into->root, from, from->root);
+    merge_ngrams(&into->ngrams, &from->ngrams);
+    into->version++;
+}
+
+// Structure of the work given to one ingestion thread: a chunk of the corpus and the trie it fills
+typedef struct IngestChunk {
+    const char *data;
+    size_t length;
+    Trie trie;
+} IngestChunk;
+
+// Function run by each ingestion thread
+static void *ingest_chunk(void *argument) {
+    IngestChunk *chunk = (IngestChunk *)argument;
+    init_trie(&chunk->trie);
+    insert_from_buffer(&chunk->trie, chunk->data, chunk->length);
+    STAT_FLUSH_THREAD();
+    return NULL;
+}
+
+// Function to get the number of processors available to the program
+int core_count(void) {
+    long cores = 1;
+#ifndef _WIN32
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cores < 1 ? 1 : (int)cores;
+}
+
+// Function to get the number of threads to ingest a corpus of the given size with
+int ingest_thread_count(size_t length) {
+    long cores = core_count();
+    // Small corpora are not worth the cost of starting threads and merging
+    size_t byChunks = length / MIN_INGEST_CHUNK + 1;
+    if (cores < 1) cores = 1;
+    if ((size_t)cores > byChunks) cores = byChunks;
+    return cores > MAX_INGEST_THREADS ? MAX_INGEST_THREADS : (int)cores;
+}
+
+// Function to clean and insert every word of a corpus file using several threads. The file is cut
+// into chunks which never split a word, each thread counts the words of its chunk in a trie of its
+// own, and those tries are then merged, which gives exactly the weights of a single-threaded build.
+bool insert_from_file_parallel(Trie *trie, const char *path, int threadCount) {
+    size_t length = 0;
+    void *mapping = map_file(path, &length);
+    if (mapping == NULL) return false;
+    const char *data = (const char *)mapping;
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > MAX_INGEST_THREADS) threadCount = MAX_INGEST_THREADS;
+
+    IngestChunk *chunks = (IngestChunk *)calloc(threadCount, sizeof(IngestChunk));
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    if (chunks == NULL || threads == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    size_t start = 0;
+    for (int t = 0; t < threadCount; t++) {
+        size_t end = t == threadCount - 1 ? length : length / threadCount * (t + 1);
+        if (end < start) end = start;
+        // Moving the end of the chunk past the word it falls in
+        while (end < length && is_word_byte((unsigned char)data[end])) end++;
+        chunks[t].data = data + start;
+        chunks[t].length = end - start;
+        start = end;
+    }
+
+    // The first chunk is ingested on the calling thread
+    int started = 1;
+    for (int t = 1; t < threadCount; t++, started++) {
+        if (pthread_create(&threads[t], NULL, ingest_chunk, &chunks[t]) != 0) break;
+    }
+    ingest_chunk(&chunks[0]);
+    // Chunks whose thread could not be started are ingested here as well
+    for (int t = started; t < threadCount; t++) {
+        ingest_chunk(&chunks[t]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int t = 0; t < threadCount; t++) {
+        merge_trie(trie, &chunks[t].trie);
+        free_trie(&chunks[t].trie);
+    }
+    free(chunks);
+    free(threads);
+    unmap_file(mapping, length);
+    return true;
+}
+
+// Function to round the size of an array of a snapshot up to a multiple of 8 bytes, so the arrays
+// after it stay aligned
+static size_t snapshot_padded_bytes(size_t bytes) {
+    return (bytes + 7) & ~(size_t)7;
+}
+
+// Function to write a frozen Trie to a binary snapshot file, recording the learning log generation it
+// holds the words of (0 for a corpus). The file is synced to disk before the function returns.
+bool save_trie_snapshot(const Trie *trie, const char *path, uint32_t logGeneration) {
+    if (!trie->frozen) {
+        printf("Only a frozen trie can be written to a snapshot\n");
+        return false;
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("Error opening file\n");
+        return false;
+    }
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.nodeCount = trie->nodeCount;
+    header.root = trie->root;
+    header.maxWeight = trie->maxWeight;
+    header.logGeneration = logGeneration;
+    header.flags = (trie->recency ? SNAPSHOT_HAS_RECENCY : 0) | (trie->radix ? SNAPSHOT_RADIX : 0);
+    header.ngramSlots = trie->ngrams.slotCount;
+    header.followerSlots = trie->ngrams.followerSlots;
+    header.ngramWordBytes = trie->ngrams.wordBytes;
+    header.edgeBytes = trie->edgeBytes;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(trie->childCount, sizeof(uint32_t), trie->nodeCount, f) == trie->nodeCount
+        && fwrite(trie->firstChild, sizeof(NodeId), trie->nodeCount, f) == trie->nodeCount
+        && fwrite(trie->weights, sizeof(uint32_t), trie->nodeCount, f) == trie->nodeCount
+        && fwrite(trie->subtreeMax, sizeof(uint32_t), trie->nodeCount, f) == trie->nodeCount;
+    if (ok && trie->recency) {
+        ok = fwrite(trie->recency, sizeof(Recency), trie->nodeCount, f) == trie->nodeCount
+            && fwrite(trie->subtreeRecency, sizeof(Recency), trie->nodeCount, f) == trie->nodeCount;
+    }
+    // The labels are padded so the n-gram arrays after them stay aligned
+    static const char padding[8] = {0};
+    size_t labelPadding = snapshot_padded_bytes(trie->nodeCount) - trie->nodeCount;
+    ok = ok && fwrite(trie->labels, 1, trie->nodeCount, f) == trie->nodeCount
+        && fwrite(padding, 1, labelPadding, f) == labelPadding;
+    if (ok && trie->radix) {
+        size_t startPadding = snapshot_padded_bytes(trie->nodeCount * sizeof(uint32_t)) - trie->nodeCount * sizeof(uint32_t);
+        size_t edgePadding = snapshot_padded_bytes(trie->edgeBytes) - trie->edgeBytes;
+        ok = fwrite(trie->edgeStart, sizeof(uint32_t), trie->nodeCount, f) == trie->nodeCount
+            && fwrite(padding, 1, startPadding, f) == startPadding
+            && fwrite(trie->edgeLength, 1, trie->nodeCount, f) == trie->nodeCount
+            && fwrite(padding, 1, labelPadding, f) == labelPadding
+            && fwrite(trie->edges, 1, trie->edgeBytes, f) == trie->edgeBytes
+            && fwrite(padding, 1, edgePadding, f) == edgePadding;
+    }
+    const NgramModel *ngrams = &trie->ngrams;
+    ok = ok && fwrite(ngrams->keys, sizeof(uint64_t), ngrams->slotCount, f) == ngrams->slotCount
+        && fwrite(ngrams->followers, sizeof(NgramFollowers), ngrams->followerSlots, f) == ngrams->followerSlots
+        && fwrite(ngrams->levels, sizeof(uint8_t), ngrams->slotCount, f) == ngrams->slotCount
+        && fwrite(ngrams->words, 1, ngrams->wordBytes, f) == ngrams->wordBytes;
+#ifndef _WIN32
+    if (ok && (fflush(f) != 0 || fsync(fileno(f)) != 0)) ok = false;
+#endif
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        printf("Error writing snapshot '%s'\n", path);
+    }
+    return ok;
+}
+
+// Function to load a snapshot file as a frozen Trie, which is queried in place inside the mapping.
+// The learning log generation recorded in the snapshot is stored in logGeneration when it is not NULL.
+bool load_trie_snapshot(Trie *trie, const char *path, uint32_t *logGeneration) {
+    size_t size = 0;
+    void *data = map_file(path, &size);
+    if (data == NULL) return false;
+
+    const SnapshotHeader *header = (const SnapshotHeader *)data;
+    bool valid = size >= sizeof(SnapshotHeader)
+        && memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SNAPSHOT_VERSION
+        && header->byteOrder == SNAPSHOT_BYTE_ORDER
+        && header->root != NULL_NODE && header->root < header->nodeCount;
+    bool radix = valid && (header->flags & SNAPSHOT_RADIX);
+    // Positions on the edges of a radix trie only have room for RADIX_NODE_BITS of node index
+    valid = valid && (!radix || header->nodeCount <= RADIX_NODE_MASK);
+    // Every node takes 16 bytes in the arrays, and 16 more with the recency arrays, followed by its label,
+    // and by the start and the length of its edge in a radix trie
+    size_t nodeBytes = valid && (header->flags & SNAPSHOT_HAS_RECENCY) ? 32 : 16;
+    size_t labelBytes = valid ? snapshot_padded_bytes(header->nodeCount) : 0;
+    size_t startBytes = radix ? snapshot_padded_bytes(header->nodeCount * sizeof(uint32_t)) : 0;
+    size_t edgeBytes = radix ? startBytes + labelBytes + snapshot_padded_bytes(header->edgeBytes) : 0;
+    size_t ngramBytes = valid ? (size_t)header->ngramSlots * (sizeof(uint64_t) + sizeof(uint8_t))
+        + (size_t)header->followerSlots * sizeof(NgramFollowers) + header->ngramWordBytes : 0;
+    valid = valid && (size - sizeof(SnapshotHeader)) / (nodeBytes + 1) >= header->nodeCount
+        && size - sizeof(SnapshotHeader) >= nodeBytes * header->nodeCount + labelBytes + edgeBytes + ngramBytes;
+    if (!valid) {
+        printf("Invalid snapshot '%s'\n", path);
+        unmap_file(data, size);
+        return false;
+    }
+
+    char *arrays = (char *)data + sizeof(SnapshotHeader);
+    init_trie(trie);
+    free_trie(trie);
+    trie->frozen = true;
+    trie->nodeCount = header->nodeCount;
+    STAT_ADD(liveNodes, header->nodeCount);
+    trie->root = header->root;
+    trie->maxWeight = header->maxWeight;
+    if (logGeneration) {
+        *logGeneration = header->logGeneration;
+    }
+    trie->childCount = (uint32_t *)arrays;
+    trie->firstChild = (NodeId *)(arrays + header->nodeCount * sizeof(uint32_t));
+    trie->weights = (uint32_t *)(arrays + header->nodeCount * (sizeof(uint32_t) + sizeof(NodeId)));
+    trie->subtreeMax = trie->weights + header->nodeCount;
+    if (header->flags & SNAPSHOT_HAS_RECENCY) {
+        trie->recency = (Recency *)(trie->subtreeMax + header->nodeCount);
+        trie->subtreeRecency = trie->recency + header->nodeCount;
+        trie->hasRecency = true;
+    }
+    trie->labels = (uint8_t *)(arrays + nodeBytes * header->nodeCount);
+    if (radix) {
+        trie->radix = true;
+        trie->edgeStart = (uint32_t *)(trie->labels + labelBytes);
+        trie->edgeLength = (uint8_t *)trie->edgeStart + startBytes;
+        trie->edges = trie->edgeLength + labelBytes;
+        trie->edgeBytes = header->edgeBytes;
+    }
+    char *ngramArrays = (char *)trie->labels + labelBytes + edgeBytes;
+    trie->ngrams.frozen = true;
+    trie->ngrams.slotCount = header->ngramSlots;
+    trie->ngrams.followerSlots = header->followerSlots;
+    trie->ngrams.wordBytes = header->ngramWordBytes;
+    trie->ngrams.keys = (uint64_t *)ngramArrays;
+    trie->ngrams.followers = (NgramFollowers *)(ngramArrays + header->ngramSlots * sizeof(uint64_t));
+    trie->ngrams.levels = (uint8_t *)(trie->ngrams.followers + header->followerSlots);
+    trie->ngrams.words = (char *)(trie->ngrams.levels + header->ngramSlots);
+    trie->mapping = data;
+    trie->mappingSize = size;
+    return true;
+}
+
+// Function to write a SymSpell index to a binary file
+bool save_symspell_index(const SymSpellIndex *index, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("Error opening file\n");
+        return false;
+    }
+    SymSpellHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SYMSPELL_MAGIC, sizeof(header.magic));
+    header.version = SYMSPELL_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.wordCount = index->wordCount;
+    header.slotCount = index->slotCount;
+    header.postingCount = index->postingCount;
+    header.stringBytes = index->stringBytes;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(index->wordOffsets, sizeof(uint32_t), index->wordCount, f) == index->wordCount
+        && fwrite(index->wordWeights, sizeof(float), index->wordCount, f) == index->wordCount
+        && fwrite(index->slots, sizeof(SymSpellSlot), index->slotCount, f) == index->slotCount
+        && fwrite(index->postings, sizeof(uint32_t), index->postingCount, f) == index->postingCount
+        && fwrite(index->strings, 1, index->stringBytes, f) == index->stringBytes;
+#ifndef _WIN32
+    if (ok && (fflush(f) != 0 || fsync(fileno(f)) != 0)) ok = false;
+#endif
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        printf("Error writing index '%s'\n", path);
+    }
+    return ok;
+}
+
+// Function to load a SymSpell index file, which is queried in place inside the mapping
+bool load_symspell_index(SymSpellIndex *index, const char *path) {
+    size_t size = 0;
+    void *data = map_file(path, &size);
+    if (data == NULL) return false;
+
+    const SymSpellHeader *header = (const SymSpellHeader *)data;
+    bool valid = size >= sizeof(SymSpellHeader)
+        && memcmp(header->magic, SYMSPELL_MAGIC, sizeof(header->magic)) == 0
+        && header->version == SYMSPELL_VERSION
+        && header->byteOrder == SNAPSHOT_BYTE_ORDER
+        && header->slotCount != 0 && (header->slotCount & (header->slotCount - 1)) == 0
+        && size - sizeof(SymSpellHeader) == (size_t)header->wordCount * (sizeof(uint32_t) + sizeof(float))
+            + (size_t)header->slotCount * sizeof(SymSpellSlot) + (size_t)header->postingCount * sizeof(uint32_t)
+            + header->stringBytes;
+    if (!valid) {
+        printf("Invalid index '%s'\n", path);
+        unmap_file(data, size);
+        return false;
+    }
+
+    char *arrays = (char *)data + sizeof(SymSpellHeader);
+    index->wordCount = header->wordCount;
+    index->slotCount = header->slotCount;
+    index->postingCount = header->postingCount;
+    index->stringBytes = header->stringBytes;
+    index->wordOffsets = (uint32_t *)arrays;
+    index->wordWeights = (float *)(index->wordOffsets + index->wordCount);
+    index->slots = (SymSpellSlot *)(index->wordWeights + index->wordCount);
+    index->postings = (uint32_t *)(index->slots + index->slotCount);
+    index->strings = (char *)(index->postings + index->postingCount);
+    index->mapping = data;
+    index->mappingSize = size;
+    return true;
+}
+
+// Free the memory of a SymSpell index
+void free_symspell_index(SymSpellIndex *index) {
+    if (index->mapping) {
+        unmap_file(index->mapping, index->mappingSize);
+    } else {
+        free(index->wordOffsets);
+        free(index->wordWeights);
+        free(index->slots);
+        free(index->postings);
+        free(index->strings);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+#ifndef _WIN32
+// Identification of the learning log, the append-only file of the words learned since the last compaction
+#define LEARNING_LOG_MAGIC "CS201LOG"
+#define LEARNING_LOG_VERSION 2
+// The log is compacted into the snapshot once it grows past this size, which bounds the time spent
+// replaying it at startup
+#ifndef LEARNING_LOG_COMPACT_BYTES
+#define LEARNING_LOG_COMPACT_BYTES (1 << 20)
+#endif
+
+// Header at the start of a learning log. It is followed by one record per learned word: its length,
+// its letters, the time it was typed and a check byte, so a record cut short by a crash is recognized
+// and dropped.
+typedef struct LearningLogHeader {
+    char magic[8];
+    uint32_t version;
+    // Incremented by every compaction, a log is only replayed if it is newer than the snapshot
+    uint32_t generation;
+} LearningLogHeader;
+
+// Structure of the learning memory of the main trie, kept in a snapshot and a log next to it. Learned
+// words are queued by the thread answering the user and written by a background thread, which syncs
+// every batch of them to disk at once and compacts the log into the snapshot when it grows too large.
+struct LearningMemory {
+    char *snapshotPath;
+    char *logPath;
+    int fd;
+    uint32_t generation;
+    // Size of the log file, and the size at which it is compacted next
+    size_t logBytes;
+    size_t compactBytes;
+    // Records queued and not written yet
+    char *pending;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t writer;
+};
+
+// Size of a log record besides the letters of its word: the length, the time and the check byte
+#define LOG_RECORD_OVERHEAD (2 + sizeof(uint32_t))
+
+// Function to get the check byte of a log record, from its word and the bytes of its time
+static uint8_t log_record_check(const char *word, int length, const char *time) {
+    uint8_t check = (uint8_t)length ^ 0x5A;
+    for (int i = 0; i < length; i++) {
+        check = (uint8_t)(check * 31 + (uint8_t)word[i]);
+    }
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+        check = (uint8_t)(check * 31 + (uint8_t)time[i]);
+    }
+    return check;
+}
+
+// Function to sync the directory holding a file, so a rename into it survives a crash
+static void sync_parent_directory(const char *path) {
+    char directory[4096];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        strcpy(directory, ".");
+    } else {
+        size_t length = slash == path ? 1 : (size_t)(slash - path);
+        if (length >= sizeof(directory)) return;
+        memcpy(directory, path, length);
+        directory[length] = '\0';
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Function to write a whole buffer to a file descriptor
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Function to start a new empty log of the given generation in place of the current one. It is written
+// aside and renamed, so the log file is never seen half written. Returns its descriptor, or -1.
+static int create_learning_log(const char *path, uint32_t generation) {
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary)) return -1;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    LearningLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEARNING_LOG_MAGIC, sizeof(header.magic));
+    header.version = LEARNING_LOG_VERSION;
+    header.generation = generation;
+    bool ok = write_all(fd, (const char *)&header, sizeof(header)) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(temporary, path) != 0) {
+        unlink(temporary);
+        return -1;
+    }
+    sync_parent_directory(path);
+    return open(path, O_WRONLY | O_APPEND);
+}
+
+// Function to load the learned words of a snapshot and of the log written after it into a new trie.
+// The generation of the snapshot is stored in snapshotGeneration, the generation of the log in
+// logGeneration (0 when there is no log newer than the snapshot) and the size of its valid part in
+// logBytes. Returns false when the snapshot exists but cannot be read.
+static bool load_learned_words(Trie *trie, const char *snapshotPath, const char *logPath, uint32_t *snapshotGeneration, uint32_t *logGeneration, size_t *logBytes) {
+    *snapshotGeneration = 0;
+    *logGeneration = 0;
+    *logBytes = 0;
+    if (access(snapshotPath, F_OK) == 0) {
+        Trie snapshot;
+        if (!load_trie_snapshot(&snapshot, snapshotPath, snapshotGeneration)) return false;
+        thaw_trie(trie, &snapshot);
+        free_trie(&snapshot);
+    } else {
+        init_trie(trie);
+    }
+    if (access(logPath, F_OK) != 0) return true;
+
+    size_t size;
+    char *data = (char *)map_file(logPath, &size);
+    if (data == NULL) return true;
+    LearningLogHeader header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+    }
+    // An older log was already compacted into the snapshot, when a crash stopped its replacement
+    if (size >= sizeof(header) && memcmp(header.magic, LEARNING_LOG_MAGIC, sizeof(header.magic)) == 0
+        && header.version == LEARNING_LOG_VERSION && header.generation > *snapshotGeneration) {
+        size_t offset = sizeof(header);
+        while (offset < size) {
+            int length = (uint8_t)data[offset];
+            if (length == 0 || length >= MAX_WORD_LENGTH || offset + LOG_RECORD_OVERHEAD + length > size) break;
+            const char *word = data + offset + 1;
+            const char *time = word + length;
+            bool valid = log_record_check(word, length, time) == (uint8_t)time[sizeof(uint32_t)];
+            for (int i = 0; valid && i < length; i++) {
+                unsigned char c = (unsigned char)word[i];
+                if (!is_word_byte(c) || lower_word_byte(c) != c || utf8_separator_length(c)) valid = false;
+            }
+            if (!valid) break;
+            uint32_t learnedAt;
+            memcpy(&learnedAt, time, sizeof(learnedAt));
+            learn_word(trie, word, length, learnedAt);
+            offset += LOG_RECORD_OVERHEAD + length;
+        }
+        *logGeneration = header.generation;
+        *logBytes = offset;
+    }
+    unmap_file(data, size);
+    return true;
+}
+
+// Function to fold the log into the snapshot. The snapshot and the log are loaded into a new trie from
+// the files, so the main trie is never touched by the writer thread, and written as the new snapshot.
+// A new empty log of the next generation is then started.
+static bool compact_learning_memory(LearningMemory *memory) {
+    Trie learned;
+    uint32_t snapshotGeneration, logGeneration;
+    size_t logBytes;
+    if (!load_learned_words(&learned, memory->snapshotPath, memory->logPath, &snapshotGeneration, &logGeneration, &logBytes)) {
+        return false;
+    }
+    freeze_trie(&learned);
+    char temporary[4096];
+    bool ok = snprintf(temporary, sizeof(temporary), "%s.tmp", memory->snapshotPath) < (int)sizeof(temporary)
+        && save_trie_snapshot(&learned, temporary, memory->generation)
+        && rename(temporary, memory->snapshotPath) == 0;
+    free_trie(&learned);
+    if (!ok) {
+        unlink(temporary);
+        return false;
+    }
+    sync_parent_directory(memory->snapshotPath);
+
+    // If the program stops before the new log replaces the old one, the old log is no newer than the
+    // snapshot and is not replayed again
+    int fd = create_learning_log(memory->logPath, memory->generation + 1);
+    if (fd < 0) {
+        printf("Error starting a new learning log\n");
+        return false;
+    }
+    close(memory->fd);
+    memory->fd = fd;
+    memory->generation++;
+    memory->logBytes = sizeof(LearningLogHeader);
+    return true;
+}
+
+// Function run by the writer thread of a learning memory. Every record queued while the previous
+// batch was being synced is written and synced in the next batch, so a sync is shared by many words.
+static void *learning_writer(void *argument) {
+    LearningMemory *memory = (LearningMemory *)argument;
+    char *batch = NULL;
+    size_t batchCapacity = 0;
+
+    pthread_mutex_lock(&memory->lock);
+    for (;;) {
+        while (memory->pendingLength == 0 && !memory->stopping && (memory->logBytes < memory->compactBytes || memory->fd < 0)) {
+            pthread_cond_wait(&memory->wake, &memory->lock);
+        }
+        if (memory->pendingLength == 0 && memory->stopping) break;
+
+        // Taking every queued record, and leaving the emptied buffer of the last batch for new ones
+        char *records = memory->pending;
+        size_t length = memory->pendingLength;
+        size_t capacity = memory->pendingCapacity;
+        memory->pending = batch;
+        memory->pendingCapacity = batchCapacity;
+        memory->pendingLength = 0;
+        batch = records;
+        batchCapacity = capacity;
+        pthread_mutex_unlock(&memory->lock);
+
+        if (length > 0 && memory->fd >= 0) {
+            if (write_all(memory->fd, batch, length) && fsync(memory->fd) == 0) {
+                memory->logBytes += length;
+            } else {
+                // The part of the batch already written is cut off, or the records appended after it could
+                // never be replayed. If that fails too, a new log is started from the valid records.
+                printf("Error writing the learning log, the last %zu bytes of learned words are lost\n", length);
+                if (ftruncate(memory->fd, memory->logBytes) != 0 && !compact_learning_memory(memory)) {
+                    printf("Error repairing the learning log, learned words are no longer saved\n");
+                    close(memory->fd);
+                    memory->fd = -1;
+                }
+            }
+        }
+        if (memory->logBytes >= memory->compactBytes && memory->fd >= 0) {
+            if (compact_learning_memory(memory)) {
+                memory->compactBytes = LEARNING_LOG_COMPACT_BYTES;
+            } else {
+                // Trying again once the log has grown as much again
+                memory->compactBytes = memory->logBytes + LEARNING_LOG_COMPACT_BYTES;
+            }
+        }
+        pthread_mutex_lock(&memory->lock);
+    }
+    pthread_mutex_unlock(&memory->lock);
+    free(batch);
+    STAT_FLUSH_THREAD();
+    return NULL;
+}
+
+// Function to open the learning memory kept in base.snap and base.log, loading the words learned so
+// far into the main trie and starting the writer thread
+bool open_learning_memory(LearningMemory *memory, const char *base, Trie *main) {
+    size_t baseLength = strlen(base);
+    memory->snapshotPath = (char *)malloc(baseLength + 6);
+    memory->logPath = (char *)malloc(baseLength + 5);
+    if (memory->snapshotPath == NULL || memory->logPath == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    sprintf(memory->snapshotPath, "%s.snap", base);
+    sprintf(memory->logPath, "%s.log", base);
+
+    uint32_t snapshotGeneration, logGeneration;
+    size_t logBytes;
+    if (!load_learned_words(main, memory->snapshotPath, memory->logPath, &snapshotGeneration, &logGeneration, &logBytes)) {
+        free(memory->snapshotPath);
+        free(memory->logPath);
+        return false;
+    }
+    if (logGeneration) {
+        // New records follow the last valid one, dropping a record cut short by a crash
+        memory->fd = open(memory->logPath, O_WRONLY | O_APPEND);
+        if (memory->fd >= 0 && ftruncate(memory->fd, logBytes) != 0) {
+            close(memory->fd);
+            memory->fd = -1;
+        }
+        memory->generation = logGeneration;
+        memory->logBytes = logBytes;
+    } else {
+        memory->generation = snapshotGeneration + 1;
+        memory->fd = create_learning_log(memory->logPath, memory->generation);
+        memory->logBytes = sizeof(LearningLogHeader);
+    }
+    if (memory->fd < 0) {
+        printf("Error opening the learning log '%s'\n", memory->logPath);
+        free_trie(main);
+        free(memory->snapshotPath);
+        free(memory->logPath);
+        return false;
+    }
+
+    memory->compactBytes = LEARNING_LOG_COMPACT_BYTES;
+    memory->pending = NULL;
+    memory->pendingLength = 0;
+    memory->pendingCapacity = 0;
+    memory->stopping = false;
+    pthread_mutex_init(&memory->lock, NULL);
+    pthread_cond_init(&memory->wake, NULL);
+    if (pthread_create(&memory->writer, NULL, learning_writer, memory) != 0) {
+        printf("Error starting the learning log writer\n");
+        exit(1);
+    }
+    return true;
+}
+
+// Function to queue a word learned at the given time to the log. It only copies the word, the writer
+// thread does the rest.
+void learning_memory_learn(LearningMemory *memory, const char *word, int length, uint32_t time) {
+    size_t recordLength = LOG_RECORD_OVERHEAD + length;
+    pthread_mutex_lock(&memory->lock);
+    if (memory->pendingLength + recordLength > memory->pendingCapacity) {
+        size_t capacity = memory->pendingCapacity ? memory->pendingCapacity * 2 : 1024;
+        while (memory->pendingLength + recordLength > capacity) capacity *= 2;
+        char *pending = (char *)realloc(memory->pending, capacity);
+        if (pending == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        memory->pending = pending;
+        memory->pendingCapacity = capacity;
+    }
+    char *record = memory->pending + memory->pendingLength;
+    record[0] = (char)length;
+    memcpy(record + 1, word, length);
+    memcpy(record + 1 + length, &time, sizeof(time));
+    record[1 + length + sizeof(time)] = (char)log_record_check(word, length, record + 1 + length);
+    memory->pendingLength += recordLength;
+    pthread_cond_signal(&memory->wake);
+    pthread_mutex_unlock(&memory->lock);
+}
+
+// Function to write the queued words, stop the writer thread and close the learning memory
+void close_learning_memory(LearningMemory *memory) {
+    pthread_mutex_lock(&memory->lock);
+    memory->stopping = true;
+    pthread_cond_signal(&memory->wake);
+    pthread_mutex_unlock(&memory->lock);
+    pthread_join(memory->writer, NULL);
+    if (memory->fd >= 0) close(memory->fd);
+    pthread_cond_destroy(&memory->wake);
+    pthread_mutex_destroy(&memory->lock);
+    free(memory->pending);
+    free(memory->snapshotPath);
+    free(memory->logPath);
+}
+#else
+// The learning memory needs POSIX file calls, without them words are only learned for the current run
+struct LearningMemory {
+    int unused;
+};
+
+void learning_memory_learn(LearningMemory *memory, const char *word, int length, uint32_t time) {
+    (void)memory;
+    (void)word;
+    (void)length;
+    (void)time;
+}
+#endif
+
+// Structure of a user served by a tenant registry, with the main trie of the words they typed. The trie
+// is either loaded, or spilled to the snapshot file of the user when it was evicted.
+typedef struct Tenant {
+    char *name;
+    uint64_t hash;
+    uint32_t id;
+    Trie main;
+    bool loaded;
+    bool spilled;
+    // Set while the main trie is being loaded or spilled without the registry locked, which nobody else
+    // touches the tenant during
+    bool busy;
+    // Bytes counted for the tenant in the registry
+    size_t bytes;
+    // Number of threads using the main trie, which is not evicted while any does
+    int users;
+    pthread_mutex_t lock;
+    // Loaded tenants, from the most to the least recently used
+    struct Tenant *newer;
+    struct Tenant *older;
+} Tenant;
+
+// Structure of a registry of the users served by one process. They all read the same corpus trie and
+// SymSpell index, which are never copied, and each has their own main trie, created when they are first
+// seen. The memory of every tenant is counted, and once the total is over the budget the least recently
+// used main tries are written to snapshots in the spill directory and freed, to be loaded again when
+// their user comes back.
+typedef struct TenantRegistry {
+    Trie *corpus;
+    const SymSpellIndex *index;
+    char *directory;
+    size_t budget;
+    size_t bytes;
+    // Open-addressing table of the tenants by the hash of their name
+    Tenant **slots;
+    uint32_t slotCount;
+    uint32_t tenantCount;
+    uint32_t loadedCount;
+    Tenant *newest;
+    Tenant *oldest;
+    // Bytes of the tenants being spilled, which no longer count against the budget
+    size_t spillingBytes;
+    unsigned long long evictions;
+    unsigned long long reloads;
+    pthread_mutex_t lock;
+    // Signaled when a tenant is no longer busy
+    pthread_cond_t idle;
+} TenantRegistry;
+
+// Function to start an empty registry of tenants sharing a corpus trie, which spills their main tries to
+// the given directory once they take more than budget bytes. The directory must exist and be writable.
+bool open_tenant_registry(TenantRegistry *registry, Trie *corpus, const SymSpellIndex *index, const char *directory, size_t budget) {
+    char probe[4096];
+    FILE *f = snprintf(probe, sizeof(probe), "%s/tenant-probe", directory) < (int)sizeof(probe) ? fopen(probe, "wb") : NULL;
+    if (!f) {
+        printf("Error writing to the spill directory '%s'\n", directory);
+        return false;
+    }
+    fclose(f);
+    remove(probe);
+    registry->corpus = corpus;
+    registry->index = index;
+    registry->directory = strdup(directory);
+    registry->budget = budget;
+    registry->slotCount = 64;
+    registry->slots = (Tenant **)calloc(registry->slotCount, sizeof(Tenant *));
+    if (registry->directory == NULL || registry->slots == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    registry->bytes = registry->slotCount * sizeof(Tenant *);
+    registry->tenantCount = 0;
+    registry->loadedCount = 0;
+    registry->newest = NULL;
+    registry->oldest = NULL;
+    registry->spillingBytes = 0;
+    registry->evictions = 0;
+    registry->reloads = 0;
+    pthread_mutex_init(&registry->lock, NULL);
+    pthread_cond_init(&registry->idle, NULL);
+    return true;
+}
+
+// Function to get the bytes allocated for a tenant: its structure with its lock, its name and, while it
+// is loaded, its main trie and the n-grams of its words. The bookkeeping of the allocator is not counted.
+static size_t tenant_memory_bytes(const Tenant *tenant) {
+    size_t bytes = sizeof(Tenant) + strlen(tenant->name) + 1;
+    if (tenant->loaded) {
+        bytes += trie_memory_bytes(&tenant->main) + ngram_memory_bytes(&tenant->main.ngrams);
+    }
+    return bytes;
+}
+
+// Function to count the current memory of a tenant in the registry
+static void recount_tenant(TenantRegistry *registry, Tenant *tenant, size_t bytes) {
+    registry->bytes += bytes - tenant->bytes;
+    tenant->bytes = bytes;
+}
+
+// Function to get the path of a file a tenant is spilled to, from its extension
+static bool tenant_spill_path(const TenantRegistry *registry, const Tenant *tenant, const char *extension, char *path, size_t size) {
+    return snprintf(path, size, "%s/tenant-%u%s", registry->directory, tenant->id, extension) < (int)size;
+}
+
+// Header of the file the n-grams of an evicted tenant are spilled to, followed by its bigram and trigram
+// tables. A snapshot only keeps the frozen n-grams, which cannot learn new words.
+typedef struct TenantNgramHeader {
+    uint32_t bigramSlots;
+    uint32_t bigramCount;
+    uint32_t trigramSlots;
+    uint32_t trigramCount;
+    uint64_t first[2];
+    int32_t firstCount;
+} TenantNgramHeader;
+
+// Function to write the tables of an n-gram model being built to a file
+static bool save_tenant_ngrams(const NgramModel *model, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    TenantNgramHeader header = {model->bigramSlots, model->bigramCount, model->trigramSlots, model->trigramCount,
+        {model->first[0], model->first[1]}, model->firstCount};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && (model->bigramSlots == 0 || fwrite(model->bigrams, sizeof(NgramBigram), model->bigramSlots, f) == model->bigramSlots)
+        && (model->trigramSlots == 0 || fwrite(model->trigrams, sizeof(NgramTrigram), model->trigramSlots, f) == model->trigramSlots);
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+// Function to read the tables of an n-gram model written by save_tenant_ngrams into an empty model
+static bool load_tenant_ngrams(NgramModel *model, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    TenantNgramHeader header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1;
+    if (ok) {
+        model->bigrams = (NgramBigram *)malloc((size_t)header.bigramSlots * sizeof(NgramBigram));
+        model->trigrams = (NgramTrigram *)malloc((size_t)header.trigramSlots * sizeof(NgramTrigram));
+        if ((header.bigramSlots && model->bigrams == NULL) || (header.trigramSlots && model->trigrams == NULL)) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        model->bigramSlots = header.bigramSlots;
+        model->bigramCount = header.bigramCount;
+        model->trigramSlots = header.trigramSlots;
+        model->trigramCount = header.trigramCount;
+        model->first[0] = header.first[0];
+        model->first[1] = header.first[1];
+        model->firstCount = header.firstCount;
+        ok = (header.bigramSlots == 0 || fread(model->bigrams, sizeof(NgramBigram), header.bigramSlots, f) == header.bigramSlots)
+            && (header.trigramSlots == 0 || fread(model->trigrams, sizeof(NgramTrigram), header.trigramSlots, f) == header.trigramSlots);
+    }
+    fclose(f);
+    if (!ok) free_ngrams(model);
+    return ok;
+}
+
+// Function to get the slot of a tenant in the table, which is either the slot holding it or the empty
+// slot where it belongs
+static uint32_t find_tenant_slot(const TenantRegistry *registry, const char *name, uint64_t hash) {
+    uint32_t mask = registry->slotCount - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    while (registry->slots[slot] && (registry->slots[slot]->hash != hash || strcmp(registry->slots[slot]->name, name) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Function to double the table of the tenants
+static void grow_tenant_table(TenantRegistry *registry) {
+    Tenant **old = registry->slots;
+    uint32_t oldCount = registry->slotCount;
+    registry->slotCount *= 2;
+    registry->slots = (Tenant **)calloc(registry->slotCount, sizeof(Tenant *));
+    if (registry->slots == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < oldCount; i++) {
+        if (old[i]) registry->slots[find_tenant_slot(registry, old[i]->name, old[i]->hash)] = old[i];
+    }
+    free(old);
+    registry->bytes += (size_t)(registry->slotCount - oldCount) * sizeof(Tenant *);
+}
+
+// Function to take a loaded tenant out of the list of recent use
+static void unlink_tenant(TenantRegistry *registry, Tenant *tenant) {
+    if (tenant->newer) tenant->newer->older = tenant->older; else registry->newest = tenant->older;
+    if (tenant->older) tenant->older->newer = tenant->newer; else registry->oldest = tenant->newer;
+    tenant->newer = NULL;
+    tenant->older = NULL;
+}
+
+// Function to put a loaded tenant first in the list of recent use
+static void push_newest_tenant(TenantRegistry *registry, Tenant *tenant) {
+    tenant->older = registry->newest;
+    tenant->newer = NULL;
+    if (registry->newest) registry->newest->newer = tenant; else registry->oldest = tenant;
+    registry->newest = tenant;
+}
+
+// Function to write the main trie of a tenant to its snapshot and its n-grams next to it, and free them.
+// The trie is frozen in place to be written, and thawed back if the files cannot be written. It only
+// touches the tenant, so it runs without the registry locked.
+static bool spill_tenant(const TenantRegistry *registry, Tenant *tenant) {
+    char path[4096], ngramPath[4096];
+    // The n-grams are taken out before freezing, which would freeze them too
+    NgramModel ngrams = tenant->main.ngrams;
+    init_ngrams(&tenant->main.ngrams);
+    freeze_trie(&tenant->main);
+    if (!tenant_spill_path(registry, tenant, ".snap", path, sizeof(path)) || !tenant_spill_path(registry, tenant, ".ngrams", ngramPath, sizeof(ngramPath))
+        || !save_trie_snapshot(&tenant->main, path, 0) || !save_tenant_ngrams(&ngrams, ngramPath)) {
+        Trie thawed;
+        thaw_trie(&thawed, &tenant->main);
+        free_trie(&tenant->main);
+        tenant->main = thawed;
+        tenant->main.ngrams = ngrams;
+        return false;
+    }
+    free_trie(&tenant->main);
+    free_ngrams(&ngrams);
+    return true;
+}
+
+// Function to load the main trie of a tenant back from the files it was spilled to, or to start an
+// empty one for a new tenant. Like spill_tenant, it runs without the registry locked.
+static bool reload_tenant(const TenantRegistry *registry, Tenant *tenant) {
+    if (!tenant->spilled) {
+        init_trie(&tenant->main);
+        return true;
+    }
+    char path[4096], ngramPath[4096];
+    Trie snapshot;
+    if (!tenant_spill_path(registry, tenant, ".snap", path, sizeof(path)) || !tenant_spill_path(registry, tenant, ".ngrams", ngramPath, sizeof(ngramPath))
+        || !load_trie_snapshot(&snapshot, path, NULL)) {
+        return false;
+    }
+    thaw_trie(&tenant->main, &snapshot);
+    free_trie(&snapshot);
+    if (!load_tenant_ngrams(&tenant->main.ngrams, ngramPath)) {
+        free_trie(&tenant->main);
+        return false;
+    }
+    return true;
+}
+
+// Function to evict the least recently used tenants nobody is using until the registry is within its
+// budget, or nothing more can be evicted. It is called with the registry locked, which it unlocks while
+// a tenant is written, so the users of the other tenants never wait for the disk.
+static void enforce_tenant_budget(TenantRegistry *registry) {
+    for (;;) {
+        if (registry->bytes - registry->spillingBytes <= registry->budget) return;
+        Tenant *tenant = registry->oldest;
+        while (tenant && (tenant->users > 0 || tenant->busy)) tenant = tenant->newer;
+        if (tenant == NULL) return;
+        size_t bytes = tenant->bytes;
+        tenant->busy = true;
+        registry->spillingBytes += bytes;
+        pthread_mutex_unlock(&registry->lock);
+        bool spilled = spill_tenant(registry, tenant);
+        pthread_mutex_lock(&registry->lock);
+        registry->spillingBytes -= bytes;
+        if (spilled) {
+            unlink_tenant(registry, tenant);
+            tenant->loaded = false;
+            tenant->spilled = true;
+            registry->loadedCount--;
+            registry->evictions++;
+        }
+        recount_tenant(registry, tenant, tenant_memory_bytes(tenant));
+        tenant->busy = false;
+        pthread_cond_broadcast(&registry->idle);
+        if (!spilled) {
+            printf("Error spilling the words of user '%s'\n", tenant->name);
+            return;
+        }
+    }
+}
+
+// Function to get the main trie of a user for one query, creating it for a new user and loading it back
+// from its snapshot for a user whose trie was evicted. The tenant is locked for the caller, who gives it
+// back with release_tenant. A snapshot is loaded without the registry locked, so only the queries of the
+// same user wait for it.
+Tenant *acquire_tenant(TenantRegistry *registry, const char *name) {
+    uint64_t hash = hash_word(name, strlen(name));
+    pthread_mutex_lock(&registry->lock);
+    if ((registry->tenantCount + 1) * 4 > registry->slotCount * 3) {
+        grow_tenant_table(registry);
+    }
+    uint32_t slot = find_tenant_slot(registry, name, hash);
+    Tenant *tenant = registry->slots[slot];
+    if (tenant == NULL) {
+        tenant = (Tenant *)calloc(1, sizeof(Tenant));
+        if (tenant == NULL || (tenant->name = strdup(name)) == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        tenant->hash = hash;
+        tenant->id = registry->tenantCount++;
+        pthread_mutex_init(&tenant->lock, NULL);
+        registry->slots[slot] = tenant;
+    }
+    // Waiting for another query of the user to load the trie, or for its eviction to finish
+    while (tenant->busy) {
+        pthread_cond_wait(&registry->idle, &registry->lock);
+    }
+    if (!tenant->loaded) {
+        tenant->busy = true;
+        pthread_mutex_unlock(&registry->lock);
+        bool reloaded = reload_tenant(registry, tenant);
+        pthread_mutex_lock(&registry->lock);
+        tenant->busy = false;
+        pthread_cond_broadcast(&registry->idle);
+        if (!reloaded) {
+            printf("Error loading the words of user '%s'\n", name);
+            pthread_mutex_unlock(&registry->lock);
+            return NULL;
+        }
+        if (tenant->spilled) registry->reloads++;
+        tenant->loaded = true;
+        registry->loadedCount++;
+        recount_tenant(registry, tenant, tenant_memory_bytes(tenant));
+    } else {
+        unlink_tenant(registry, tenant);
+    }
+    push_newest_tenant(registry, tenant);
+    tenant->users++;
+    enforce_tenant_budget(registry);
+    pthread_mutex_unlock(&registry->lock);
+    pthread_mutex_lock(&tenant->lock);
+    return tenant;
+}
+
+// Function to give back a tenant taken with acquire_tenant, counting the memory its main trie grew by.
+// The registry is locked before the tenant is unlocked, so the count is never replaced by an older one.
+void release_tenant(TenantRegistry *registry, Tenant *tenant) {
+    pthread_mutex_lock(&registry->lock);
+    recount_tenant(registry, tenant, tenant_memory_bytes(tenant));
+    tenant->users--;
+    pthread_mutex_unlock(&tenant->lock);
+    enforce_tenant_budget(registry);
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// Function to answer a sentence of a user with the shared corpus and the main trie of the user
+bool tenant_answer(TenantRegistry *registry, const char *name, char choice, char *sentence, TextBuffer *out) {
+    Tenant *tenant = acquire_tenant(registry, name);
+    if (tenant == NULL) return false;
+    answer_sentence(registry->corpus, registry->index, &tenant->main, NULL, choice, sentence, out);
+    release_tenant(registry, tenant);
+    return true;
+}
+
+// Function to free every tenant of a registry and delete the snapshots they were spilled to
+void close_tenant_registry(TenantRegistry *registry) {
+    for (uint32_t i = 0; i < registry->slotCount; i++) {
+        Tenant *tenant = registry->slots[i];
+        if (tenant == NULL) continue;
+        char path[4096];
+        if (tenant->loaded) {
+            free_trie(&tenant->main);
+        }
+        if (tenant->spilled && tenant_spill_path(registry, tenant, ".snap", path, sizeof(path))) {
+            remove(path);
+        }
+        if (tenant->spilled && tenant_spill_path(registry, tenant, ".ngrams", path, sizeof(path))) {
+            remove(path);
+        }
+        pthread_mutex_destroy(&tenant->lock);
+        free(tenant->name);
+        free(tenant);
+    }
+    free(registry->slots);
+    free(registry->directory);
+    pthread_cond_destroy(&registry->idle);
+    pthread_mutex_destroy(&registry->lock);
+}
+
+// Function to print the tenants of a registry and the memory they use
+void print_tenant_stats(const TenantRegistry *registry) {
+    printf("Tenants: %u, %u loaded, %zu bytes of %zu, %llu evictions, %llu reloads\n", registry->tenantCount,
+        registry->loadedCount, registry->bytes, registry->budget, registry->evictions, registry->reloads);
+}
+
+// Function to answer every line of a file for the user named by its first word, in the order of the
+// lines, with the main trie of that user. The words a user learned in a line are kept for their next lines.
+bool run_tenant_batch(TenantRegistry *registry, char choice, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error opening file\n");
+        return false;
+    }
+    bool ok = true;
+    char line[MAX_WORD_LENGTH * 10];
+    while (ok && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *sentence = line + strcspn(line, " \t");
+        if (*sentence) *sentence++ = '\0';
+        if (line[0] == '\0') continue;
+        TextBuffer answer = {NULL, 0, 0};
+        ok = tenant_answer(registry, line, choice, sentence, &answer);
+        fwrite(answer.data, 1, answer.length, stdout);
+        free(answer.data);
+    }
+    fclose(f);
+    return ok;
+}
+
+// Set by --radix to freeze the corpus trie in the radix layout
+bool radixCorpus = false;
+
+// Function to build the corpus trie from a text file and freeze it
+bool build_corpus_trie(Trie *trie, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error opening file\n");
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    rewind(f);
+    init_trie(trie);
+    STAT_TIMER(ingestTimer);
+    if (length > 0) {
+        fclose(f);
+        if (!insert_from_file_parallel(trie, path, ingest_thread_count(length))) {
+            free_trie(trie);
+            return false;
+        }
+    } else {
+        // Files without a known size, such as pipes, are read as a stream
+        insert_from_file(trie, f);
+        fclose(f);
+    }
+    STAT_ADD_TIME(ingestSeconds, ingestTimer);
+
+    // The corpus trie does not change from here on, so it is switched to the compact layout
+    STAT_TIMER(freezeTimer);
+    if (radixCorpus) {
+        freeze_radix_trie(trie);
+    } else {
+        freeze_trie(trie);
+    }
+    STAT_ADD_TIME(freezeSeconds, freezeTimer);
+    return true;
+}
+
+// Function to print the counters of every thread so far and the memory used by the tries
+void print_stats(const Trie *corpus, const Trie *main) {
+#ifdef AUTOFILL_STATS
+    STAT_FLUSH_THREAD();
+    pthread_mutex_lock(&statsLock);
+    Stats stats = totalStats;
+    pthread_mutex_unlock(&statsLock);
+    printf("Statistics:\n");
+    printf("  queries: %llu, %.3f ms\n", stats.queries, stats.querySeconds * 1e3);
+    printf("  fill nodes visited: %llu\n", stats.fillNodesVisited);
+    printf("  correct nodes visited: %llu\n", stats.correctNodesVisited);
+    printf("  levenshtein calls: %llu, cells: %llu\n", stats.levenshteinCalls, stats.levenshteinCells);
+    printf("  create_node calls: %llu, live nodes: %lld\n", stats.createNodeCalls, stats.liveNodes);
+    printf("  ingest: %.3f ms, freeze: %.3f ms\n", stats.ingestSeconds * 1e3, stats.freezeSeconds * 1e3);
+#endif
+    printf("  corpus trie: %u nodes, %zu bytes\n", corpus->nodeCount, trie_memory_bytes(corpus));
+    printf("  corpus n-grams: %zu bytes\n", ngram_memory_bytes(&corpus->ngrams));
+    if (main) {
+        printf("  main trie: %u nodes, %zu bytes\n", main->nodeCount, trie_memory_bytes(main));
+    }
+}
+
+// Function to print the memory used by a SymSpell index
+void print_symspell_overhead(const SymSpellIndex *index) {
+    printf("SymSpell index: %u words, %u deletion variants, %.1f KB\n",
+        index->wordCount, index->postingCount, symspell_memory_bytes(index) / 1024.0);
+}
+
+// Function to run an auto-fill session over keystrokes read one character at a time, printing the
+// suggestions after each one. Letters extend the word, '<' (or a backspace) erases the last letter,
+// a space starts a new word and '.' ends the session.
+void run_autofill_session(Trie *corpus, Trie *main) {
+    AutofillSession *session = (AutofillSession *)malloc(sizeof(AutofillSession));
+    if (session == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    session_start(session, corpus, main);
+
+    int ch;
+    while ((ch = getchar()) != EOF && ch != '.') {
+        if (ch == '<' || ch == '\b' || ch == 127) {
+            if (!session_pop_char(session)) continue;
+        } else if (ch == ' ') {
+            session_start(session, corpus, main);
+            continue;
+        } else if (!session_push_char(session, ch)) {
+            continue;
+        }
+
+        char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+        double weights[MAX_SUGGESTIONS];
+        TextBuffer trace = {NULL, 0, 0};
+        QUERY_TRACE_BEGIN();
+        int count = session_suggestions(session, suggestions, weights);
+        QUERY_TRACE_END(&trace);
+        printf("\"%s\":", session->prefix);
+        for (int i = 0; i < count; i++) {
+            printf(" %s (%.4f)", suggestions[i], weights[i]);
+        }
+        printf("\n");
+        if (trace.length) {
+            fwrite(trace.data, 1, trace.length, stdout);
+        }
+        free(trace.data);
+    }
+    free(session);
+}
+
+// Structure shared by the threads answering the lines of a batch file. The corpus trie and the
+// SymSpell index are only read, so every thread uses them directly. In unified mode every thread
+// builds its own unified trie from the corpus trie, since the user words are added to its nodes.
+typedef struct BatchJob {
+    Trie *corpus;
+    const SymSpellIndex *index;
+    char choice;
+    bool unified;
+    const char *data;
+    // Line i of the file covers the bytes from lineStarts[i] up to the newline before lineStarts[i + 1]
+    size_t *lineStarts;
+    size_t lineCount;
+    // The next line no thread has taken yet
+    size_t nextLine;
+    TextBuffer *answers;
+    bool *done;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} BatchJob;
+
+// Function run by each thread of a batch, which takes lines one at a time until none are left
+static void *batch_worker(void *argument) {
+    BatchJob *job = (BatchJob *)argument;
+    Trie mainTrie;
+    if (job->unified) {
+        build_unified_trie(&mainTrie, job->corpus);
+    } else {
+        init_trie(&mainTrie);
+    }
+    char *sentence = NULL;
+    size_t sentenceCapacity = 0;
+
+    for (;;) {
+        size_t line = __atomic_fetch_add(&job->nextLine, 1, __ATOMIC_RELAXED);
+        if (line >= job->lineCount) break;
+
+        // The line ends before its newline, and lines ending with "\r\n" are answered like the others
+        size_t start = job->lineStarts[line];
+        size_t length = job->lineStarts[line + 1] - 1 - start;
+        while (length > 0 && (job->data[start + length - 1] == '\r' || job->data[start + length - 1] == '\n')) length--;
+        if (length + 1 > sentenceCapacity) {
+            sentenceCapacity = length + 1;
+            sentence = (char *)realloc(sentence, sentenceCapacity);
+            if (sentence == NULL) {
+                printf("Memory allocation failed!\n");
+                exit(1);
+            }
+        }
+        memcpy(sentence, job->data + start, length);
+        sentence[length] = '\0';
+
+        // Each line is answered on its own, so the words learned from the previous one are dropped
+        TextBuffer answer = {NULL, 0, 0};
+        if (job->unified) {
+            clear_user_words(&mainTrie);
+            answer_sentence(&mainTrie, NULL, &mainTrie, NULL, job->choice, sentence, &answer);
+        } else {
+            reset_trie(&mainTrie);
+            answer_sentence(job->corpus, job->index, &mainTrie, NULL, job->choice, sentence, &answer);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->answers[line] = answer;
+        job->done[line] = true;
+        pthread_cond_broadcast(&job->ready);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(sentence);
+    free_trie(&mainTrie);
+    release_query_scratch();
+    STAT_FLUSH_THREAD();
+    return NULL;
+}
+
+// Function to answer every line of a file as if it was typed as the sentence of an auto-fill ('f') or
+// auto-correct ('c') query, using one thread per processor. The answers are printed in the order of
+// the lines, each as soon as it and all the lines before it are done.
+bool run_batch(Trie *corpus, const SymSpellIndex *index, char choice, bool unified, const char *path) {
+    size_t size;
+    char *data = (char *)map_file(path, &size);
+    if (data == NULL) return false;
+
+    BatchJob job;
+    job.corpus = corpus;
+    job.index = index;
+    job.choice = choice;
+    job.unified = unified;
+    job.data = data;
+    job.nextLine = 0;
+
+    // Finding where the lines start, the last one may not end with a newline
+    size_t lineCount = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') lineCount++;
+    }
+    if (data[size - 1] != '\n') lineCount++;
+    job.lineCount = lineCount;
+    job.lineStarts = (size_t *)malloc((lineCount + 1) * sizeof(size_t));
+    job.answers = (TextBuffer *)calloc(lineCount, sizeof(TextBuffer));
+    job.done = (bool *)calloc(lineCount, sizeof(bool));
+    if (job.lineStarts == NULL || job.answers == NULL || job.done == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    size_t line = 0;
+    job.lineStarts[0] = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') job.lineStarts[++line] = i + 1;
+    }
+    // A last line with no newline ends as if there was one after the end of the file
+    if (data[size - 1] != '\n') job.lineStarts[lineCount] = size + 1;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.ready, NULL);
+
+    int threadCount = core_count();
+    if ((size_t)threadCount > lineCount) threadCount = (int)lineCount;
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    if (threads == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    int started = 0;
+    for (; started < threadCount; started++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &job) != 0) break;
+    }
+    if (started == 0) {
+        // Answering every line on this thread when no thread could be started
+        batch_worker(&job);
+    }
+
+    for (size_t i = 0; i < lineCount; i++) {
+        pthread_mutex_lock(&job.lock);
+        while (!job.done[i]) {
+            pthread_cond_wait(&job.ready, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+        fwrite(job.answers[i].data, 1, job.answers[i].length, stdout);
+        free(job.answers[i].data);
+    }
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&job.ready);
+    pthread_mutex_destroy(&job.lock);
+    free(threads);
+    free(job.done);
+    free(job.answers);
+    free(job.lineStarts);
+    unmap_file(data, size);
+    return true;
+}
+
+// Function to print how the program can be started
+void print_usage(const char *program) {
+    printf("Usage: %s [--snapshot file | --radix] [--symspell | --symspell-index file] [--unified] [--batch f|c file [--tenants megabytes directory]] [--memory base] [--half-life days] [--stats] [--trace]\n", program);
+    printf("       %s --build-snapshot corpus.txt file [--radix]\n", program);
+    printf("       %s --build-symspell corpus.txt file\n", program);
+}
+
+#ifndef AUTOFILL_NO_MAIN
+// Main function which performs the auto-fill and auto-correct functionalities
+int main(int argc, char *argv[]) {
+    Trie root, mainTrieRoot;
+    SymSpellIndex index;
+    const char *snapshotPath = NULL;
+    const char *indexPath = NULL;
+    const char *batchPath = NULL;
+    const char *memoryBase = NULL;
+    const char *tenantDirectory = NULL;
+    double tenantBudget = 0;
+    LearningMemory memory;
+    char batchChoice = 0;
+    bool buildIndex = false;
+    bool printStats = false;
+    bool unified = false;
+
+    if ((argc == 4 || (argc == 5 && strcmp(argv[4], "--radix") == 0)) && strcmp(argv[1], "--build-snapshot") == 0) {
+        // Writing the corpus trie to a snapshot instead of running interactively
+        radixCorpus = argc == 5;
+        if (!build_corpus_trie(&root, argv[2])) return 1;
+        bool saved = save_trie_snapshot(&root, argv[3], 0);
+        if (saved) {
+            printf("Snapshot of %u nodes written to '%s'\n", root.nodeCount - 1, argv[3]);
+        }
+        free_trie(&root);
+        return saved ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "--build-symspell") == 0) {
+        // Writing the SymSpell index of the corpus instead of running interactively
+        if (!build_corpus_trie(&root, argv[2])) return 1;
+        build_symspell_index(&index, &root);
+        bool saved = save_symspell_index(&index, argv[3]);
+        if (saved) {
+            print_symspell_overhead(&index);
+        }
+        free_symspell_index(&index);
+        free_trie(&root);
+        return saved ? 0 : 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--symspell-index") == 0 && i + 1 < argc) {
+            indexPath = argv[++i];
+        } else if (strcmp(argv[i], "--symspell") == 0) {
+            buildIndex = true;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 2 < argc
+                   && (strcmp(argv[i + 1], "f") == 0 || strcmp(argv[i + 1], "c") == 0)) {
+            batchChoice = argv[i + 1][0];
+            batchPath = argv[i + 2];
+            i += 2;
+        } else if (strcmp(argv[i], "--tenants") == 0 && i + 2 < argc) {
+            tenantBudget = atof(argv[i + 1]);
+            tenantDirectory = argv[i + 2];
+            i += 2;
+            if (tenantBudget <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            memoryBase = argv[++i];
+        } else if (strcmp(argv[i], "--half-life") == 0 && i + 1 < argc) {
+            // A half-life of 0 days stops the decay of the learned words
+            recencyHalfLife = atof(argv[++i]) * 24 * 3600;
+            if (recencyHalfLife < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--unified") == 0) {
+            unified = true;
+        } else if (strcmp(argv[i], "--radix") == 0) {
+            radixCorpus = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            printStats = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            traceQueries = true;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef AUTOFILL_STATS
+    if (printStats || traceQueries) {
+        printf("Statistics are not compiled in, compile with -DAUTOFILL_STATS to use --stats and --trace\n");
+        return 1;
+    }
+#endif
+    if (unified && (buildIndex || indexPath)) {
+        printf("A unified trie is corrected by walking it, it cannot be used with a SymSpell index\n");
+        return 1;
+    }
+    if (radixCorpus && snapshotPath) {
+        printf("A snapshot keeps the layout it was built with, build it with --radix instead\n");
+        return 1;
+    }
+    if (memoryBase && (unified || batchPath)) {
+        printf("The learning memory keeps the words of the main trie, it cannot be used with --unified or --batch\n");
+        return 1;
+    }
+    if (tenantDirectory && (!batchPath || unified || memoryBase)) {
+        printf("Tenants share the corpus trie in batch mode, they cannot be used without --batch or with --unified or --memory\n");
+        return 1;
+    }
+#ifdef _WIN32
+    if (memoryBase) {
+        printf("The learning memory is not available on this platform\n");
+        return 1;
+    }
+#endif
+
+    // Loading the corpus data from a snapshot if one was given, otherwise from the text file
+    if (snapshotPath) {
+        if (!load_trie_snapshot(&root, snapshotPath, NULL)) return 1;
+    } else if (!build_corpus_trie(&root, "corpus_sample.txt")) {
+        return 1;
+    }
+    // The SymSpell index is optional, auto-correct walks the corpus trie without it
+    bool useIndex = buildIndex || indexPath;
+    if (indexPath) {
+        if (!load_symspell_index(&index, indexPath)) return 1;
+        print_symspell_overhead(&index);
+    } else if (buildIndex) {
+        build_symspell_index(&index, &root);
+        print_symspell_overhead(&index);
+    }
+    if (batchPath) {
+        // Answering every line of the batch file instead of running interactively
+        bool answered;
+        if (tenantDirectory) {
+            TenantRegistry registry;
+            answered = open_tenant_registry(&registry, &root, useIndex ? &index : NULL, tenantDirectory, (size_t)(tenantBudget * 1024 * 1024));
+            if (answered) {
+                answered = run_tenant_batch(&registry, batchChoice, batchPath);
+                if (printStats) {
+                    print_tenant_stats(&registry);
+                }
+                close_tenant_registry(&registry);
+            }
+        } else {
+            answered = run_batch(&root, useIndex ? &index : NULL, batchChoice, unified, batchPath);
+        }
+        if (printStats) {
+            print_stats(&root, NULL);
+        }
+        free_trie(&root);
+        if (useIndex) {
+            free_symspell_index(&index);
+        }
+        return answered ? 0 : 1;
+    }
+    // The main trie starts with the words learned in the previous runs when a learning memory is used
+#ifndef _WIN32
+    if (memoryBase) {
+        if (!open_learning_memory(&memory, memoryBase, &mainTrieRoot)) {
+            printf("Error loading the learning memory '%s'\n", memoryBase);
+            free_trie(&root);
+            if (useIndex) {
+                free_symspell_index(&index);
+            }
+            return 1;
+        }
+    } else
+#endif
+    init_trie(&mainTrieRoot);
+
+    // Gettting a choice from the user for auto-fill or auto-correct
+    char choice;
+    printf("Enter 'f' for Auto-fill, 'c' for Auto-correct and 's' for an Auto-fill session: ");
+    scanf(" %c", &choice);
+    // Clear the newline left in the input buffer by scanf
+    getchar(); 
+
+    int status = 0;
+    if (choice == 's' && unified) {
+        // A session follows the corpus and the main trie side by side, which a unified trie merges
+        printf("An auto-fill session walks the corpus and the main trie, it cannot be used with --unified\n");
+        status = 1;
+    } else if (choice == 's') {
+        // Auto-fill session, answering every keystroke from the state left by the previous ones
+        printf("Type letters, '<' to erase one and '.' to stop:\n");
+        run_autofill_session(&root, &mainTrieRoot);
+    } else {
+        // Getting a input sentence from the user
+        char sentence[MAX_WORD_LENGTH * 10];
+        printf("Enter a sentence: ");
+        if (fgets(sentence, sizeof(sentence), stdin) == NULL) {
+            sentence[0] = '\0';
+        }
+        // Removing the newline character
+        sentence[strcspn(sentence, "\n")] = '\0';  
+
+        // In unified mode the main trie is replaced by one trie holding both the corpus and the user words
+        Trie *corpus = &root;
+        if (unified) {
+            free_trie(&mainTrieRoot);
+            build_unified_trie(&mainTrieRoot, &root);
+            corpus = &mainTrieRoot;
+        }
+
+        // Processing the input sentence and its last word
+        TextBuffer answer = {NULL, 0, 0};
+        answer_sentence(corpus, useIndex ? &index : NULL, &mainTrieRoot, memoryBase ? &memory : NULL, choice, sentence, &answer);
+        fwrite(answer.data, 1, answer.length, stdout);
+        free(answer.data);
+    }
+
+    if (printStats) {
+        print_stats(&root, &mainTrieRoot);
+    }
+
+    // Free allocated memory, after the learned words are written to the learning memory
+#ifndef _WIN32
+    if (memoryBase) {
+        close_learning_memory(&memory);
+    }
+#endif
+    free_trie(&root);
+    free_trie(&mainTrieRoot);
+    if (useIndex) {
+        free_symspell_index(&index);
+    }
+    release_query_scratch();
+
+    return status;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,750 @@
+// Benchmark of the auto-correct lookups, comparing the SymSpell index against the corpus trie walk,
+// and a suite measuring the whole program on generated corpora, which prints its results as JSON
+// Compile: gcc -O2 benchmark.c -o benchmark -lm -pthread
+// Run:     ./benchmark [corpus.txt] [number of queries]
+//          ./benchmark --suite [largest corpus in words] [queries per case] > results.json
+//          ./benchmark --check-parallel [corpus.txt] [largest number of threads]
+//          ./benchmark --check-batch [corpus.txt]
+
+// Including the program itself without its main function
+#define AUTOFILL_NO_MAIN
+#include "CS_201_Project_Grp18.c"
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Corpus sizes of the suite in words, and the exponent of the Zipf distribution the words follow
+static const long SUITE_SIZES[] = {10000, 100000, 1000000, 10000000};
+#define SUITE_ZIPF_EXPONENT 1.0
+#define SUITE_MAX_VOCABULARY 200000
+#define SUITE_MAX_PREFIX 5
+// Reader threads of the concurrency case, the length of their prefixes and the number of words its
+// writer cycles through
+#define SUITE_MAX_READERS 4
+#define SUITE_READER_PREFIX 3
+#define SUITE_LEARNED_WORDS 100000
+// Entries of the prefix cache, and the number of auto-fill queries for every word learned meanwhile
+#define SUITE_PREFIX_CACHE 4096
+#define SUITE_LEARN_EVERY 20
+// Length of the prefixes of fuzzy completion, which are given with typos
+#define SUITE_FUZZY_PREFIX 6
+
+// Function to get the current time in seconds from a monotonic clock
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to make a misspelling of a word with the given number of random edits
+void misspell_by(const char *word, char *out, int edits) {
+    strcpy(out, word);
+    for (int e = 0; e < edits; e++) {
+        int length = strlen(out);
+        int pos = length ? rand() % length : 0;
+        int kind = rand() % 3;
+        if (kind == 0 && length > 1) {
+            // Deleting a letter
+            memmove(out + pos, out + pos + 1, length - pos);
+        } else if (kind == 1 && length + 1 < MAX_WORD_LENGTH) {
+            // Inserting a letter
+            memmove(out + pos + 1, out + pos, length - pos + 1);
+            out[pos] = 'a' + rand() % Total_Alphabets;
+        } else if (length > 0) {
+            // Substituting a letter
+            out[pos] = 'a' + rand() % Total_Alphabets;
+        }
+    }
+}
+
+// Function to make a misspelling of a word with up to LEVENSHTEIN_LIMIT random edits
+void misspell(const char *word, char *out) {
+    misspell_by(word, out, rand() % (LEVENSHTEIN_LIMIT + 1));
+}
+
+// Generator of the words of a synthetic corpus, deterministic so every run measures the same corpora
+typedef struct ZipfGenerator {
+    uint64_t state;
+    int vocabularySize;
+    char (*vocabulary)[MAX_WORD_LENGTH];
+    // cumulative[r] is the probability of drawing one of the r + 1 most frequent words
+    double *cumulative;
+} ZipfGenerator;
+
+// Function to get the next pseudo-random number of a generator (xorshift64*)
+uint64_t zipf_next(ZipfGenerator *generator) {
+    generator->state ^= generator->state >> 12;
+    generator->state ^= generator->state << 25;
+    generator->state ^= generator->state >> 27;
+    return generator->state * 2685821657736338717ull;
+}
+
+// Function to make a vocabulary of random words of 3 to 10 letters whose frequencies follow Zipf's law
+void zipf_start(ZipfGenerator *generator, int vocabularySize) {
+    generator->state = 201;
+    generator->vocabularySize = vocabularySize;
+    generator->vocabulary = malloc((size_t)vocabularySize * MAX_WORD_LENGTH);
+    generator->cumulative = malloc((size_t)vocabularySize * sizeof(double));
+    if (generator->vocabulary == NULL || generator->cumulative == NULL) {
+        printf("Memory allocation failed!\n");
+        exit(1);
+    }
+    double total = 0;
+    for (int r = 0; r < vocabularySize; r++) {
+        int length = 3 + zipf_next(generator) % 8;
+        for (int i = 0; i < length; i++) {
+            generator->vocabulary[r][i] = 'a' + zipf_next(generator) % Total_Alphabets;
+        }
+        generator->vocabulary[r][length] = '\0';
+        total += 1.0 / pow(r + 1, SUITE_ZIPF_EXPONENT);
+        generator->cumulative[r] = total;
+    }
+    for (int r = 0; r < vocabularySize; r++) {
+        generator->cumulative[r] /= total;
+    }
+}
+
+// Function to draw a word of the vocabulary according to its frequency
+const char *zipf_word(ZipfGenerator *generator) {
+    double u = (zipf_next(generator) >> 11) * (1.0 / 9007199254740992.0);
+    int low = 0, high = generator->vocabularySize - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (generator->cumulative[middle] < u) low = middle + 1;
+        else high = middle;
+    }
+    return generator->vocabulary[low];
+}
+
+void zipf_free(ZipfGenerator *generator) {
+    free(generator->vocabulary);
+    free(generator->cumulative);
+}
+
+// Function to write a corpus of the given number of words drawn from a generator to a new temporary file
+bool write_zipf_corpus(ZipfGenerator *generator, long words, char *path) {
+    strcpy(path, "/tmp/cs201_corpus_XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Error creating a temporary corpus file\n");
+        return false;
+    }
+    FILE *f = fdopen(fd, "w");
+    for (long w = 0; w < words; w++) {
+        fputs(zipf_word(generator), f);
+        fputc(w % 16 == 15 ? '\n' : ' ', f);
+    }
+    fclose(f);
+    return true;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to print the 50th, 99th and 99.9th percentiles of some latencies as JSON fields, in microseconds,
+// with the given prefix before their names
+void print_percentiles(const char *name, double *latencies, int count) {
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("\"%sp50_us\": %.3f, \"%sp99_us\": %.3f, \"%sp999_us\": %.3f", name, latencies[(int)(count * 0.5)] * 1e6,
+        name, latencies[(int)(count * 0.99)] * 1e6, name, latencies[(int)(count * 0.999)] * 1e6);
+}
+
+// Function to time the auto-fill of every query. With a unified trie, corpus and main are both that trie.
+void time_fill(Trie *corpus, Trie *main, char (*queries)[MAX_WORD_LENGTH], int queryCount, double *latencies) {
+    char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    double weights[MAX_SUGGESTIONS];
+    for (int q = 0; q < queryCount; q++) {
+        int count = 0;
+        double start = now_seconds();
+        NodeId corpusNode = findPrefixNode(corpus, queries[q]);
+        NodeId mainNode = main->unified ? NULL_NODE : findPrefixNode(main, queries[q]);
+        if (corpusNode || mainNode) {
+            suggestWords(corpus, corpusNode, main, mainNode, queries[q], suggestions, weights, &count, MAX_SUGGESTIONS);
+        }
+        latencies[q] = now_seconds() - start;
+    }
+}
+
+// Function to time the auto-correct of every query. With a unified trie, corpus and main are both that trie.
+// Function to measure auto-fill with the prefix cache of a fresh main trie, into which a corpus word is
+// learned every SUITE_LEARN_EVERY queries, and print the percentiles and the counters of the cache as
+// JSON fields
+void time_cached_fill(Trie *corpus, ZipfGenerator *generator, char (*queries)[MAX_WORD_LENGTH], int queryCount, double *latencies) {
+    Trie mainTrie;
+    init_trie(&mainTrie);
+    enable_prefix_cache(&mainTrie, SUITE_PREFIX_CACHE);
+    PrefixCache *cache = mainTrie.prefixCache;
+    char suggestions[PREFIX_CACHE_RESULTS][MAX_WORD_LENGTH];
+    double weights[PREFIX_CACHE_RESULTS];
+    for (int q = 0; q < queryCount; q++) {
+        if (q % SUITE_LEARN_EVERY == 0) {
+            const char *word = zipf_word(generator);
+            learn_word(&mainTrie, word, strlen(word), recency_now());
+        }
+        int count = 0;
+        double start = now_seconds();
+        if (!prefix_cache_lookup(cache, &mainTrie, queries[q], suggestions, weights, &count, MAX_SUGGESTIONS)) {
+            NodeId corpusNode = findPrefixNode(corpus, queries[q]);
+            NodeId mainNode = findPrefixNode(&mainTrie, queries[q]);
+            if (corpusNode || mainNode) {
+                suggestWords(corpus, corpusNode, &mainTrie, mainNode, queries[q], suggestions, weights, &count, PREFIX_CACHE_RESULTS);
+            }
+            prefix_cache_store(cache, &mainTrie, queries[q], suggestions, weights, count);
+        }
+        latencies[q] = now_seconds() - start;
+    }
+    print_percentiles("cached_", latencies, queryCount);
+    printf(", \"cached_hit_rate\": %.3f, \"cached_evictions\": %llu, \"cached_invalidations\": %llu, \"cached_flushes\": %llu",
+        (double)cache->hits / (cache->hits + cache->misses), cache->evictions, cache->invalidations, cache->flushes);
+    free_trie(&mainTrie);
+}
+
+// Function to measure fuzzy completion on prefixes with typos
+void time_fuzzy_fill(Trie *corpus, Trie *main, char (*queries)[MAX_WORD_LENGTH], int queryCount, double *latencies) {
+    Suggestion suggestions[MAX_SUGGESTIONS];
+    for (int q = 0; q < queryCount; q++) {
+        double start = now_seconds();
+        find_fuzzy_completions(corpus, main, queries[q], 0.7, suggestions, MAX_SUGGESTIONS);
+        latencies[q] = now_seconds() - start;
+    }
+}
+
+void time_correct(Trie *corpus, Trie *main, char (*queries)[MAX_WORD_LENGTH], int queryCount, double *latencies) {
+    TextBuffer out = {NULL, 0, 0};
+    for (int q = 0; q < queryCount; q++) {
+        out.length = 0;
+        double start = now_seconds();
+        suggest_words_for_correction(main, corpus, NULL, queries[q], 0.7, &out);
+        latencies[q] = now_seconds() - start;
+    }
+    free(out.data);
+}
+
+// Structure shared by the threads of the concurrency case: a writer learning words into the main trie
+// until it is stopped, and readers timing auto-fill queries meanwhile. With a lock, every query and every
+// learned word holds it, as a server has to without a concurrent trie.
+typedef struct ConcurrencyCase {
+    Trie *corpus;
+    Trie *main;
+    pthread_mutex_t *lock;
+    char (*learned)[MAX_WORD_LENGTH];
+    long learnedCount;
+    bool stopping;
+    char (*queries)[MAX_WORD_LENGTH];
+    int queryCount;
+    double *latencies;
+} ConcurrencyCase;
+
+typedef struct ConcurrencyReader {
+    ConcurrencyCase *test;
+    int first;
+} ConcurrencyReader;
+
+static void *concurrency_writer(void *argument) {
+    ConcurrencyCase *test = (ConcurrencyCase *)argument;
+    long count = 0;
+    while (!__atomic_load_n(&test->stopping, __ATOMIC_ACQUIRE)) {
+        const char *word = test->learned[count % SUITE_LEARNED_WORDS];
+        if (test->lock) pthread_mutex_lock(test->lock);
+        learn_word(test->main, word, strlen(word), (uint32_t)count);
+        ngram_add_word(&test->main->ngrams, hash_word(word, strlen(word)));
+        if (test->lock) pthread_mutex_unlock(test->lock);
+        count++;
+    }
+    test->learnedCount = count;
+    return NULL;
+}
+
+static void *concurrency_reader(void *argument) {
+    ConcurrencyReader *reader = (ConcurrencyReader *)argument;
+    ConcurrencyCase *test = reader->test;
+    char suggestions[MAX_SUGGESTIONS][MAX_WORD_LENGTH];
+    double weights[MAX_SUGGESTIONS];
+    for (int q = 0; q < test->queryCount; q++) {
+        const char *query = test->queries[(reader->first + q) % test->queryCount];
+        int count = 0;
+        double start = now_seconds();
+        if (test->lock) {
+            pthread_mutex_lock(test->lock);
+        } else {
+            begin_trie_read();
+        }
+        NodeId corpusNode = findPrefixNode(test->corpus, query);
+        NodeId mainNode = findPrefixNode(test->main, query);
+        if (corpusNode || mainNode) {
+            suggestWords(test->corpus, corpusNode, test->main, mainNode, (char *)query, suggestions, weights, &count, MAX_SUGGESTIONS);
+        }
+        if (test->lock) {
+            pthread_mutex_unlock(test->lock);
+        } else {
+            end_trie_read();
+        }
+        test->latencies[(size_t)reader->first * test->queryCount + q] = now_seconds() - start;
+    }
+    release_reader_slot();
+    return NULL;
+}
+
+// Function to time the auto-fill queries of readers on a fresh main trie, while a writer learns words
+// into it if writing is set, and print their percentiles as JSON fields with the given prefix
+void time_concurrency(ConcurrencyCase *test, int readers, bool writing, bool locked, const char *name) {
+    Trie mainTrie;
+    init_trie(&mainTrie);
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    if (!locked) make_trie_concurrent(&mainTrie);
+    test->main = &mainTrie;
+    test->lock = locked ? &lock : NULL;
+    test->stopping = false;
+    test->learnedCount = 0;
+    pthread_t writer, threads[SUITE_MAX_READERS];
+    ConcurrencyReader readerArguments[SUITE_MAX_READERS];
+    if (writing) pthread_create(&writer, NULL, concurrency_writer, test);
+    for (int i = 0; i < readers; i++) {
+        readerArguments[i].test = test;
+        readerArguments[i].first = i;
+        pthread_create(&threads[i], NULL, concurrency_reader, &readerArguments[i]);
+    }
+    for (int i = 0; i < readers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (writing) {
+        __atomic_store_n(&test->stopping, true, __ATOMIC_RELEASE);
+        pthread_join(writer, NULL);
+    }
+    print_percentiles(name, test->latencies, readers * test->queryCount);
+    if (writing) printf(", \"%slearned_words\": %ld", name, test->learnedCount);
+    free_trie(&mainTrie);
+}
+
+// Function to measure one corpus size of the suite and print its results as a JSON object. It runs in
+// a process of its own, so the peak memory reported is the one of this corpus alone.
+void run_suite_corpus(long words, int queryCount) {
+    int vocabularySize = words / 20 < 1000 ? 1000 : (words / 20 > SUITE_MAX_VOCABULARY ? SUITE_MAX_VOCABULARY : words / 20);
+    ZipfGenerator generator;
+    zipf_start(&generator, vocabularySize);
+    char path[64];
+    if (!write_zipf_corpus(&generator, words, path)) exit(1);
+
+    Trie corpus, mainTrie;
+    double start = now_seconds();
+    bool built = build_corpus_trie(&corpus, path);
+    double buildTime = now_seconds() - start;
+    remove(path);
+    if (!built) exit(1);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    uint32_t distinct = 0;
+    for (NodeId node = 1; node < corpus.nodeCount; node++) {
+        if (trie_is_end(&corpus, node)) distinct++;
+    }
+    printf("    {\"words\": %ld, \"vocabulary\": %d, \"distinct_words\": %u, \"nodes\": %u, \"nodes_per_word\": %.3f, ",
+        words, vocabularySize, distinct, corpus.nodeCount - 1, distinct ? (double)(corpus.nodeCount - 1) / distinct : 0.0);
+    printf("\"trie_bytes\": %zu, \"build_seconds\": %.3f, \"peak_rss_kb\": %ld,\n",
+        trie_memory_bytes(&corpus), buildTime, usage.ru_maxrss);
+
+    // The queries are made of corpus words drawn with their frequencies, against an empty main trie,
+    // and the same queries are timed again against a unified trie holding the corpus and against the
+    // corpus in the radix layout
+    Trie unifiedTrie, radixTrie;
+    init_trie(&mainTrie);
+    build_unified_trie(&unifiedTrie, &corpus);
+    thaw_trie(&radixTrie, &corpus);
+    freeze_radix_trie(&radixTrie);
+    printf("     \"radix_nodes\": %u, \"radix_nodes_per_word\": %.3f, \"radix_trie_bytes\": %zu, \"unified_trie_bytes\": %zu,\n",
+        radixTrie.nodeCount - 1, distinct ? (double)(radixTrie.nodeCount - 1) / distinct : 0.0, trie_memory_bytes(&radixTrie),
+        trie_memory_bytes(&unifiedTrie));
+    double *latencies = malloc((size_t)queryCount * sizeof(double));
+    char (*queries)[MAX_WORD_LENGTH] = malloc((size_t)queryCount * MAX_WORD_LENGTH);
+    srand(201);
+
+    printf("     \"fill\": [");
+    for (int prefixLength = 1; prefixLength <= SUITE_MAX_PREFIX; prefixLength++) {
+        for (int q = 0; q < queryCount; q++) {
+            const char *word;
+            do {
+                word = zipf_word(&generator);
+            } while ((int)strlen(word) < prefixLength);
+            memcpy(queries[q], word, prefixLength);
+            queries[q][prefixLength] = '\0';
+        }
+        printf("%s\n       {\"prefix_length\": %d, ", prefixLength > 1 ? "," : "", prefixLength);
+        time_fill(&corpus, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("", latencies, queryCount);
+        printf(", ");
+        time_fill(&unifiedTrie, &unifiedTrie, queries, queryCount, latencies);
+        print_percentiles("unified_", latencies, queryCount);
+        printf(", ");
+        time_fill(&radixTrie, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("radix_", latencies, queryCount);
+        printf(", ");
+        time_cached_fill(&corpus, &generator, queries, queryCount, latencies);
+        printf("}");
+    }
+    printf("],\n");
+
+    printf("     \"correct\": [");
+    for (int edits = 0; edits <= LEVENSHTEIN_LIMIT; edits++) {
+        for (int q = 0; q < queryCount; q++) {
+            misspell_by(zipf_word(&generator), queries[q], edits);
+        }
+        printf("%s\n       {\"typo_edits\": %d, ", edits > 0 ? "," : "", edits);
+        time_correct(&corpus, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("", latencies, queryCount);
+        printf(", ");
+        time_correct(&unifiedTrie, &unifiedTrie, queries, queryCount, latencies);
+        print_percentiles("unified_", latencies, queryCount);
+        printf(", ");
+        time_correct(&radixTrie, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("radix_", latencies, queryCount);
+        printf("}");
+    }
+    printf("],\n");
+
+    printf("     \"fuzzy_fill\": [");
+    for (int edits = 1; edits <= LEVENSHTEIN_LIMIT; edits++) {
+        for (int q = 0; q < queryCount; q++) {
+            const char *word;
+            do {
+                word = zipf_word(&generator);
+            } while ((int)strlen(word) < SUITE_FUZZY_PREFIX);
+            char prefix[MAX_WORD_LENGTH];
+            memcpy(prefix, word, SUITE_FUZZY_PREFIX);
+            prefix[SUITE_FUZZY_PREFIX] = '\0';
+            misspell_by(prefix, queries[q], edits);
+        }
+        printf("%s\n       {\"prefix_length\": %d, \"typo_edits\": %d, ", edits > 1 ? "," : "", SUITE_FUZZY_PREFIX, edits);
+        time_fuzzy_fill(&corpus, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("", latencies, queryCount);
+        printf(", ");
+        time_fuzzy_fill(&radixTrie, &mainTrie, queries, queryCount, latencies);
+        print_percentiles("radix_", latencies, queryCount);
+        printf("}");
+    }
+    printf("],\n");
+
+    // Readers auto-fill prefixes of corpus words while a writer learns misspelled corpus words, which
+    // keep adding nodes to the main trie: with no writer, with a lock around every query and learned
+    // word, and with a concurrent main trie read without locks
+    int readers = core_count() - 1;
+    if (readers > SUITE_MAX_READERS) readers = SUITE_MAX_READERS;
+    if (readers < 1) readers = 1;
+    ConcurrencyCase test = {0};
+    test.corpus = &corpus;
+    test.queries = queries;
+    test.queryCount = queryCount;
+    test.latencies = malloc((size_t)readers * queryCount * sizeof(double));
+    test.learned = malloc((size_t)SUITE_LEARNED_WORDS * MAX_WORD_LENGTH);
+    for (int q = 0; q < queryCount; q++) {
+        const char *word;
+        do {
+            word = zipf_word(&generator);
+        } while ((int)strlen(word) < SUITE_READER_PREFIX);
+        memcpy(queries[q], word, SUITE_READER_PREFIX);
+        queries[q][SUITE_READER_PREFIX] = '\0';
+    }
+    for (int w = 0; w < SUITE_LEARNED_WORDS; w++) {
+        misspell_by(zipf_word(&generator), test.learned[w], 2);
+    }
+    printf("     \"concurrent_fill\": {\"readers\": %d, \"prefix_length\": %d, ", readers, SUITE_READER_PREFIX);
+    time_concurrency(&test, readers, false, false, "idle_");
+    printf(", ");
+    time_concurrency(&test, readers, true, true, "locked_");
+    printf(", ");
+    time_concurrency(&test, readers, true, false, "lock_free_");
+    printf("}}");
+    fflush(stdout);
+    free(test.latencies);
+    free(test.learned);
+
+    free(queries);
+    free(latencies);
+    release_query_scratch();
+    free_trie(&unifiedTrie);
+    free_trie(&radixTrie);
+    free_trie(&mainTrie);
+    free_trie(&corpus);
+    zipf_free(&generator);
+}
+
+// Function to run the suite over every corpus size up to the given number of words
+int run_suite(long maxWords, int queryCount) {
+    printf("{\"zipf_exponent\": %.2f, \"queries_per_case\": %d, \"threads\": %d,\n \"corpora\": [\n",
+        SUITE_ZIPF_EXPONENT, queryCount, core_count());
+    int printed = 0;
+    for (size_t i = 0; i < sizeof(SUITE_SIZES) / sizeof(SUITE_SIZES[0]) && SUITE_SIZES[i] <= maxWords; i++) {
+        if (printed++) printf(",\n");
+        // Flushing first so the child process does not print the buffered output again
+        fflush(stdout);
+        fprintf(stderr, "Measuring a corpus of %ld words\n", SUITE_SIZES[i]);
+        pid_t child = fork();
+        if (child == 0) {
+            run_suite_corpus(SUITE_SIZES[i], queryCount);
+            exit(0);
+        }
+        int status = 1;
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "The measurement of %ld words failed\n", SUITE_SIZES[i]);
+            return 1;
+        }
+    }
+    printf("\n ]}\n");
+    return 0;
+}
+
+// Recursive function to count the words below a node of the serial trie whose count differs in the
+// parallel trie, printing the first ones
+long compare_word_counts(const Trie *serial, NodeId node, const Trie *parallel, NodeId other, char *word, int depth, long *words) {
+    long differences = 0;
+    if (trie_is_end(serial, node)) {
+        (*words)++;
+        uint32_t expected = trie_count(serial, node);
+        uint32_t found = other && trie_is_end(parallel, other) ? trie_count(parallel, other) : 0;
+        if (found != expected) {
+            word[depth] = '\0';
+            if (differences++ < 5) printf("  '%s' counted %u times instead of %u\n", word, found, expected);
+        }
+    }
+    if (depth + 1 >= MAX_WORD_LENGTH) return differences;
+    int cursor = 0;
+    unsigned char label;
+    NodeId child;
+    while (trie_next_child(serial, node, &cursor, &label, &child)) {
+        word[depth] = (char)label;
+        NodeId otherChild = other ? trie_child(parallel, other, label) : NULL_NODE;
+        differences += compare_word_counts(serial, child, parallel, otherChild, word, depth + 1, words);
+    }
+    return differences;
+}
+
+// Function to count the bigrams and trigrams of the serial model whose count differs in the parallel one
+long compare_ngram_counts(const NgramModel *serial, const NgramModel *parallel) {
+    long differences = 0;
+    for (uint32_t i = 0; i < serial->bigramSlots; i++) {
+        const NgramBigram *bigram = &serial->bigrams[i];
+        if (bigram->first && bigram_count(parallel, bigram->first, bigram->second) != bigram->count) differences++;
+    }
+    for (uint32_t i = 0; i < serial->trigramSlots; i++) {
+        const NgramTrigram *trigram = &serial->trigrams[i];
+        if (trigram->key == 0) continue;
+        const NgramTrigram *found = parallel->trigramSlots ? &parallel->trigrams[find_trigram_slot(parallel->trigrams, parallel->trigramSlots, trigram->key)] : NULL;
+        if (found == NULL || found->key != trigram->key || found->count != trigram->count) differences++;
+    }
+    if (serial->bigramCount != parallel->bigramCount || serial->trigramCount != parallel->trigramCount) differences++;
+    if (serial->firstCount != parallel->firstCount || memcmp(serial->first, parallel->first, serial->firstCount * sizeof(uint64_t)) != 0) differences++;
+    return differences;
+}
+
+// Function to check that building the corpus trie on 1 to maxThreads threads gives exactly the word
+// counts and the n-gram counts of the serial build
+int check_parallel_build(const char *path, int maxThreads) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error opening file\n");
+        return 1;
+    }
+    Trie serial;
+    init_trie(&serial);
+    insert_from_file(&serial, f);
+    fclose(f);
+
+    int failures = 0;
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        Trie parallel;
+        init_trie(&parallel);
+        if (!insert_from_file_parallel(&parallel, path, threads)) return 1;
+        char word[MAX_WORD_LENGTH];
+        long words = 0;
+        long wordDifferences = compare_word_counts(&serial, serial.root, &parallel, parallel.root, word, 0, &words);
+        if (parallel.nodeCount != serial.nodeCount || parallel.maxWeight != serial.maxWeight) wordDifferences++;
+        long ngramDifferences = compare_ngram_counts(&serial.ngrams, &parallel.ngrams);
+        printf("%d threads: %ld words, %ld word differences, %u bigrams, %u trigrams, %ld n-gram differences\n", threads,
+            words, wordDifferences, parallel.ngrams.bigramCount, parallel.ngrams.trigramCount, ngramDifferences);
+        if (wordDifferences || ngramDifferences) failures++;
+        free_trie(&parallel);
+    }
+    free_trie(&serial);
+    printf(failures ? "The parallel build differs from the serial build\n" : "The parallel build matches the serial build\n");
+    return failures ? 1 : 0;
+}
+
+// Sentences of the batch check, answered from files with each kind of line ending. The last one ends
+// with a space, which a newline left in the last line of a file would turn into a completion.
+static const char *BATCH_CHECK_LINES[] = {"the sun ris", "recieve", "reconect the", "the sun "};
+#define BATCH_CHECK_COPIES 3
+
+// Function to answer a batch file, returning everything run_batch printed
+char *batch_output(Trie *corpus, char choice, const char *path) {
+    char outputPath[] = "/tmp/batch-check-XXXXXX";
+    int fd = mkstemp(outputPath);
+    if (fd < 0) {
+        printf("Error creating a temporary file\n");
+        exit(1);
+    }
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    bool answered = run_batch(corpus, NULL, choice, false, path);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    off_t length = lseek(fd, 0, SEEK_END);
+    char *output = (char *)malloc(length + 1);
+    if (output == NULL || pread(fd, output, length, 0) != length || !answered) {
+        printf("Error answering the batch file\n");
+        exit(1);
+    }
+    output[length] = '\0';
+    close(fd);
+    remove(outputPath);
+    return output;
+}
+
+// Function to write a batch file of the given text
+void write_batch_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fputs(text, f) < 0 || fclose(f) != 0) {
+        printf("Error writing '%s'\n", path);
+        exit(1);
+    }
+}
+
+// Function to check that the lines of a batch file are answered the same whether they end with "\n",
+// with "\r\n" or are the last line of the file with no newline
+int check_batch_lines(const char *corpusPath) {
+    Trie corpus;
+    if (!build_corpus_trie(&corpus, corpusPath)) return 1;
+    const char *path = "/tmp/batch-check-lines.txt";
+    static const char *endings[] = {"\n", "\r\n", ""};
+    static const char *names[] = {"LF", "CRLF", "no final newline"};
+    int lineCount = sizeof(BATCH_CHECK_LINES) / sizeof(BATCH_CHECK_LINES[0]);
+    int failures = 0;
+    for (int c = 0; c < 2; c++) {
+        char choice = c ? 'c' : 'f';
+        // The expected answer of every line is the one of a file holding that line alone
+        size_t expectedLength = 0;
+        char *answers[sizeof(BATCH_CHECK_LINES) / sizeof(BATCH_CHECK_LINES[0])];
+        for (int i = 0; i < lineCount; i++) {
+            write_batch_file(path, BATCH_CHECK_LINES[i]);
+            answers[i] = batch_output(&corpus, choice, path);
+            expectedLength += strlen(answers[i]);
+        }
+        char *expected = (char *)malloc(expectedLength * BATCH_CHECK_COPIES + 1);
+        char *text = (char *)malloc(BATCH_CHECK_COPIES * lineCount * (MAX_WORD_LENGTH + 2) + 1);
+        if (expected == NULL || text == NULL) {
+            printf("Memory allocation failed!\n");
+            exit(1);
+        }
+        expected[0] = '\0';
+        for (int copy = 0; copy < BATCH_CHECK_COPIES; copy++) {
+            for (int i = 0; i < lineCount; i++) strcat(expected, answers[i]);
+        }
+        for (int e = 0; e < 3; e++) {
+            // Every line but the last ends with a newline in the file with no final newline
+            text[0] = '\0';
+            for (int copy = 0; copy < BATCH_CHECK_COPIES; copy++) {
+                for (int i = 0; i < lineCount; i++) {
+                    strcat(text, BATCH_CHECK_LINES[i]);
+                    bool last = copy == BATCH_CHECK_COPIES - 1 && i == lineCount - 1;
+                    strcat(text, e < 2 ? endings[e] : last ? "" : "\n");
+                }
+            }
+            write_batch_file(path, text);
+            char *output = batch_output(&corpus, choice, path);
+            bool same = strcmp(output, expected) == 0;
+            printf("%s, '%c': %s\n", names[e], choice, same ? "every line answered as alone" : "the answers differ");
+            if (!same) failures++;
+            free(output);
+        }
+        for (int i = 0; i < lineCount; i++) free(answers[i]);
+        free(expected);
+        free(text);
+    }
+    remove(path);
+    release_query_scratch();
+    free_trie(&corpus);
+    printf(failures ? "Batch lines are answered differently by their ending\n" : "Batch lines are answered the same with any ending\n");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--check-batch") == 0) {
+        return check_batch_lines(argc > 2 ? argv[2] : "corpus_sample.txt");
+    }
+    if (argc > 1 && strcmp(argv[1], "--check-parallel") == 0) {
+        int maxThreads = argc > 3 ? atoi(argv[3]) : 8;
+        if (maxThreads < 1 || maxThreads > MAX_INGEST_THREADS) maxThreads = MAX_INGEST_THREADS;
+        return check_parallel_build(argc > 2 ? argv[2] : "corpus_sample.txt", maxThreads);
+    }
+    if (argc > 1 && strcmp(argv[1], "--suite") == 0) {
+        long maxWords = argc > 2 ? atol(argv[2]) : 10000000;
+        int suiteQueries = argc > 3 ? atoi(argv[3]) : 5000;
+        if (suiteQueries <= 0) suiteQueries = 5000;
+        return run_suite(maxWords, suiteQueries);
+    }
+    const char *corpusPath = argc > 1 ? argv[1] : "corpus_sample.txt";
+    int queryCount = argc > 2 ? atoi(argv[2]) : 10000;
+    if (queryCount <= 0) queryCount = 10000;
+
+    Trie corpus;
+    if (!build_corpus_trie(&corpus, corpusPath)) return 1;
+
+    double start = now_seconds();
+    SymSpellIndex index;
+    build_symspell_index(&index, &corpus);
+    double buildTime = now_seconds() - start;
+    if (index.wordCount == 0) {
+        printf("The corpus has no words\n");
+        return 1;
+    }
+
+    printf("Corpus trie: %u nodes, %.1f KB\n", corpus.nodeCount - 1, trie_memory_bytes(&corpus) / 1024.0);
+    printf("SymSpell index: %u words, %u deletion variants, %.1f KB, built in %.3f s\n",
+        index.wordCount, index.postingCount, symspell_memory_bytes(&index) / 1024.0, buildTime);
+
+    // The same misspelled queries are used for both lookups
+    srand(201);
+    char (*queries)[MAX_WORD_LENGTH] = malloc((size_t)queryCount * MAX_WORD_LENGTH);
+    for (int q = 0; q < queryCount; q++) {
+        const char *word = index.strings + index.wordOffsets[rand() % index.wordCount];
+        misspell(word, queries[q]);
+    }
+
+    CorrectionSet candidates = {0};
+    static int rows[MAX_WORD_LENGTH + 1][MAX_WORD_LENGTH + 1];
+    char prefix[MAX_WORD_LENGTH];
+    long trieFound = 0, indexFound = 0;
+
+    start = now_seconds();
+    for (int q = 0; q < queryCount; q++) {
+        int length = strlen(queries[q]);
+        for (int j = 0; j <= length; j++) rows[0][j] = j;
+        prefix[0] = '\0';
+        clear_correction_set(&candidates);
+        collect_suggestions(&corpus, corpus.root, prefix, 0, rows, &candidates, queries[q], length, 0.7, 1.0);
+        trieFound += candidates.count;
+    }
+    double trieTime = now_seconds() - start;
+
+    start = now_seconds();
+    for (int q = 0; q < queryCount; q++) {
+        clear_correction_set(&candidates);
+        collect_symspell_suggestions(&index, &candidates, queries[q], strlen(queries[q]), 0.7, 1.0);
+        indexFound += candidates.count;
+    }
+    double indexTime = now_seconds() - start;
+
+    printf("Trie walk:      %8.2f us per query, %ld candidates\n", trieTime * 1e6 / queryCount, trieFound);
+    printf("SymSpell index: %8.2f us per query, %ld candidates\n", indexTime * 1e6 / queryCount, indexFound);
+    if (trieFound != indexFound) {
+        printf("Warning: the two lookups found a different number of candidates\n");
+    }
+
+    free(queries);
+    free_correction_set(&candidates);
+    free_symspell_index(&index);
+    free_trie(&corpus);
+    return 0;
+}